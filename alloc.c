@@ -0,0 +1,113 @@
+#define _GNU_SOURCE
+#include "alloc.h"
+#include "util.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// from <numaif.h>, which needs libnuma's headers
+#define MPOL_PREFERRED 1
+
+static bool is_huge(size_t size) {
+  return size >= HUGE_PAGE_SIZE / 2;
+}
+
+static size_t huge_round(size_t size) {
+  return (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+}
+
+void *huge_alloc(size_t size, const char *field_name) {
+  if (!is_huge(size))
+    return m_alloc(NULL, size, field_name);
+
+  size_t len = huge_round(size);
+  void *ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (ptr != MAP_FAILED)
+    return ptr;
+
+  // no reserved huge pages: map an extra huge page, trim the ends to align the
+  // buffer on a huge page boundary and ask for transparent huge pages
+  char *raw = mmap(NULL, len + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED) {
+#ifndef LOG_CLEANER_LIBRARY // as m_alloc
+    printf("Unable to allocate memory for %s\n", field_name);
+#endif
+    return NULL;
+  }
+  char *aligned = (char *)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+  if (aligned > raw)
+    munmap(raw, aligned - raw);
+  size_t tail = (raw + len + HUGE_PAGE_SIZE) - (aligned + len);
+  if (tail > 0)
+    munmap(aligned + len, tail);
+  madvise(aligned, len, MADV_HUGEPAGE);
+  return aligned;
+}
+
+void huge_free(void *ptr, size_t size) {
+  if (ptr == NULL)
+    return;
+  if (!is_huge(size))
+    free(ptr);
+  else
+    munmap(ptr, huge_round(size));
+}
+
+// Parse a sysfs list such as "0-3,8,10-11" into the ids it holds
+static int parse_list(const char *path, int *ids, int max) {
+  FILE *fp = fopen(path, "r");
+  if (!fp)
+    return 0;
+  int count = 0;
+  int first, last;
+  while (fscanf(fp, "%d", &first) == 1) {
+    last = first;
+    int ch = fgetc(fp);
+    if (ch == '-') {
+      if (fscanf(fp, "%d", &last) != 1)
+        break;
+      ch = fgetc(fp);
+    }
+    for (int id = first; id <= last && count < max; id++)
+      ids[count++] = id;
+    if (ch != ',')
+      break;
+  }
+  fclose(fp);
+  return count;
+}
+
+// The online NUMA nodes, 0 when the system does not report any
+int numa_nodes(int *nodes, int max) {
+  return parse_list("/sys/devices/system/node/online", nodes, max);
+}
+
+// Keep the calling thread on the CPUs of a NUMA node and have the memory it first
+// touches placed on that node, so its buffers are local to it. Best effort: on
+// failure the thread runs and allocates as before.
+void numa_bind_thread(int node) {
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+  int cpus[CPU_SETSIZE];
+  int count = parse_list(path, cpus, CPU_SETSIZE);
+  if (count == 0)
+    return;
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int i = 0; i < count; i++)
+    CPU_SET(cpus[i], &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+  unsigned long mask[MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = {0};
+  if (node < MAX_NUMA_NODES) {
+    mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+    syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, MAX_NUMA_NODES + 1);
+  }
+}
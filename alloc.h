@@ -0,0 +1,21 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+
+// buffers from half this size up are mapped as (transparent) huge pages
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+// program limitation: NUMA nodes beyond this are not used for worker placement
+#define MAX_NUMA_NODES 64
+
+// Large, long lived buffers (input blocks, output buffers, regex tables). Uses
+// MAP_HUGETLB where huge pages are reserved, otherwise a huge page aligned mapping
+// with MADV_HUGEPAGE, and malloc for small sizes. Free with the same size.
+// NULL when out of memory.
+void *huge_alloc(size_t size, const char *field_name);
+void huge_free(void *ptr, size_t size);
+
+int numa_nodes(int *nodes, int max);
+void numa_bind_thread(int node);
+
+#endif
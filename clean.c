@@ -0,0 +1,664 @@
+#define _GNU_SOURCE
+#include "clean.h"
+#include "inplace.h"
+#include "match.h"
+#include "reader.h"
+#include "util.h"
+#include "writer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// An output file of a job. Outputs are written as temporary files that only get
+// their names once complete, so a failed or interrupted job leaves the log file as
+// it found it and no partial outputs behind.
+typedef struct Output {
+  char *path;
+  Writer *writer;
+  bool committed;
+  off_t size;           // bytes written, the offset of the next entry
+  struct Output *index; // sidecar index of a removed file, NULL without --index
+} Output;
+
+// Takes over path, which is NULL when naming the output ran out of memory
+static bool open_output(Output *output, char *path, const char *file_path, char *err, size_t err_len) {
+  output->path = path;
+  if (path == NULL) {
+    snprintf(err, err_len, "Out of memory naming the outputs of %s", file_path);
+    return false;
+  }
+  output->writer = writer_open_temp(path);
+  if (output->writer == NULL) {
+    snprintf(err, err_len, "Error creating %s: %s", path, strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+static bool open_in_place(Output *output, char *path, const char *file_path, char *err, size_t err_len) {
+  output->path = path;
+  if (path == NULL) {
+    snprintf(err, err_len, "Out of memory naming the outputs of %s", file_path);
+    return false;
+  }
+  output->writer = writer_open_in_place(path);
+  if (output->writer == NULL) {
+    snprintf(err, err_len, "Error opening %s: %s", path, strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+static bool commit_output(Output *output, bool sync, char *err, size_t err_len) {
+  int error = writer_commit(output->writer, sync);
+  if (error) {
+    snprintf(err, err_len, "Unable to save %s: %s", output->path, strerror(error));
+    return false;
+  }
+  output->committed = true;
+  return true;
+}
+
+// Close and free the outputs. Uncommitted ones vanish, committed ones are deleted
+// too unless keep is set.
+static void discard_outputs(Output *outputs, int count, bool keep) {
+  for (int i = 0; i < count; i++) {
+    if (outputs[i].writer != NULL)
+      writer_close(outputs[i].writer);
+    if (outputs[i].committed && !keep)
+      unlink(outputs[i].path);
+    free(outputs[i].path);
+  }
+  free(outputs);
+}
+
+// The index of a removed file sits next to it, with .idx in place of .log
+static char *index_path(const char *removed_path) {
+  char *path = NULL;
+  path = m_alloc(path, strlen(removed_path) + 1, "index file path");
+  if (path != NULL) {
+    strcpy(path, removed_path);
+    strcpy(path + strlen(path) - strlen("log"), "idx");
+  }
+  return path;
+}
+
+// outputs[0] is the cleaned file, which replaces the log file, or in live mode the
+// log file itself; it is left closed without with_cleaned. With --retain, outputs[1]
+// is the shared removed file and identifiers with a bucket write their removed
+// entries to a file of their own, removed_<bucket>_<log_file_name>_<timestamp>.log,
+// at outputs[2 + bucket]. With --index, the indexes of those removed files follow
+// them, in the same order. With --extract they are named extracted_ rather than
+// removed_. NULL with err set when one cannot be opened.
+static Output *open_outputs(const char *file_path, const Config *config, Settings settings, bool with_cleaned,
+                            int *output_count, char *err, size_t err_len) {
+  const char *kind = settings.extract ? "extracted" : "removed";
+  int removed_count = settings.saveRemovedItems ? 1 + config->bucket_count : 0;
+  *output_count = 1 + (settings.index ? 2 : 1) * removed_count;
+  Output *outputs = NULL;
+  outputs = m_alloc(outputs, *output_count * sizeof(Output), "job outputs");
+  if (outputs == NULL) {
+    snprintf(err, err_len, "Out of memory cleaning %s", file_path);
+    return NULL;
+  }
+  memset(outputs, 0, *output_count * sizeof(Output));
+
+  bool opened = true;
+  if (with_cleaned) {
+    char *cleaned_path = NULL;
+    cleaned_path = m_alloc(cleaned_path, strlen(file_path) + 1, "cleaned file path");
+    if (cleaned_path != NULL)
+      strcpy(cleaned_path, file_path);
+    opened = settings.live ? open_in_place(&outputs[0], cleaned_path, file_path, err, err_len)
+                           : open_output(&outputs[0], cleaned_path, file_path, err, err_len);
+  }
+  if (opened && settings.saveRemovedItems)
+    opened = open_output(&outputs[1], create_timestamped_file_path(file_path, kind), file_path, err, err_len);
+  for (int i = 0; opened && i < removed_count - 1; i++) {
+    char *prefix = NULL;
+    prefix = m_alloc(prefix, strlen(kind) + 1 + strlen(config->buckets[i]) + 1, "bucket file prefix");
+    if (prefix == NULL) {
+      snprintf(err, err_len, "Out of memory naming the bucket files of %s", file_path);
+      opened = false;
+      break;
+    }
+    sprintf(prefix, "%s_%s", kind, config->buckets[i]);
+    opened = open_output(&outputs[2 + i], create_timestamped_file_path(file_path, prefix), file_path, err, err_len);
+    free(prefix);
+  }
+  for (int i = 1; opened && settings.index && i <= removed_count; i++) {
+    outputs[i].index = &outputs[i + removed_count];
+    opened = open_output(outputs[i].index, index_path(outputs[i].path), file_path, err, err_len);
+  }
+  if (!opened) {
+    discard_outputs(outputs, *output_count, false);
+    return NULL;
+  }
+  return outputs;
+}
+
+// Write a removed record to its bucket's file, or the shared removed file. Its
+// index gets a line with the record's offset in the file and the identifier's name,
+// or 1-based position, that removed it.
+static void save_removed(Output *outputs, const Config *config, int identifier, const Record *record) {
+  int bucket = config->identifiers[identifier]->bucket;
+  Output *output = &outputs[bucket >= 0 ? 2 + bucket : 1];
+  if (output->index != NULL) {
+    char line[64];
+    const char *name = config->identifiers[identifier]->name;
+    int len = name ? snprintf(line, sizeof(line), "%lld\t", (long long)output->size)
+                   : snprintf(line, sizeof(line), "%lld\t%d\n", (long long)output->size, identifier + 1);
+    writer_write(output->index->writer, line, len);
+    if (name) {
+      writer_write(output->index->writer, name, strlen(name));
+      writer_write(output->index->writer, "\n", 1);
+    }
+  }
+  writer_write(output->writer, record->data, record->len);
+  output->size += record->len;
+}
+
+static void echo_removed(const Record *record) {
+  fputs("Removed: ", stdout);
+  fwrite(record->data, 1, record->content_len, stdout);
+  putchar('\n');
+}
+
+typedef enum {
+  SPARSE_CLEANED,
+  SPARSE_FAILED,
+  SPARSE_COMPACT // not suited to sparse cleaning, the log file is unchanged
+} SparseResult;
+
+// The runs of consecutive removed records and padding lines, with the empty lines
+// within and right after them. False when there are more than SPARSE_MAX_RUNS.
+static bool find_runs(Reader *reader, const Config *config, MatchState *state, CleanStats *stats, Range *runs,
+                      int *run_count) {
+  Record record;
+  off_t offset = 0;
+  bool in_run = false;
+  *run_count = 0;
+  while (reader_next_record(reader, config->record_start, config->record_start_len, &record)) {
+    off_t start = offset;
+    offset += record.len;
+    if (record.content_len == 0) { // empty lines only join a run
+      if (in_run)
+        runs[*run_count - 1].end = offset;
+      continue;
+    }
+    bool padding = is_padding(record.data, record.content_len);
+    if (!padding && matching_identifier(record.data, record.content_len, config, state) < 0) {
+      stats->kept_entries++;
+      stats->kept_bytes += record.len;
+      in_run = false;
+      continue;
+    }
+    if (!padding) {
+      stats->removed_entries++;
+      stats->removed_bytes += record.len;
+    }
+    if (in_run) {
+      runs[*run_count - 1].end = offset;
+      continue;
+    }
+    if (*run_count == SPARSE_MAX_RUNS)
+      return false;
+    runs[(*run_count)++] = (Range){start, offset};
+    in_run = true;
+  }
+  return true;
+}
+
+// Save and echo the records of the runs, reading only the runs
+static void save_runs(Reader *reader, const Config *config, MatchState *state, const Range *runs, int run_count,
+                      Output *outputs, Settings settings) {
+  Record record;
+  for (int i = 0; i < run_count; i++) {
+    reader_seek(reader, runs[i].start);
+    off_t offset = runs[i].start;
+    while (offset < runs[i].end &&
+           reader_next_record(reader, config->record_start, config->record_start_len, &record)) {
+      offset += record.len;
+      int identifier = record.content_len > 0 && !is_padding(record.data, record.content_len)
+                           ? matching_identifier(record.data, record.content_len, config, state)
+                           : -1;
+      if (identifier < 0)
+        continue;
+      if (settings.saveRemovedItems)
+        save_removed(outputs, config, identifier, &record);
+      if (!settings.quiet)
+        echo_removed(&record);
+    }
+  }
+}
+
+// Whether most of the removed bytes would only become padding: collapsing cuts out
+// just the whole blocks of a run, and a run ending the file, at size, is truncated
+static bool mostly_padding(int fd, const Range *runs, int run_count, off_t size) {
+  off_t removed = 0;
+  off_t cut = 0;
+  for (int i = 0; i < run_count; i++) {
+    removed += runs[i].end - runs[i].start;
+    cut += runs[i].end >= size ? runs[i].end - runs[i].start : collapsible_bytes(fd, runs[i].start, runs[i].end);
+  }
+  return cut * 2 < removed;
+}
+
+// Cut the runs out of the log file, from the last one back so the offsets of those
+// before it stay put. The last run holding a whole block goes first, to find out
+// whether the file system can collapse before anything else is changed.
+static SparseResult cut_runs(int fd, const Range *runs, int run_count, char separator, const char *file_path,
+                             char *err, size_t err_len) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    snprintf(err, err_len, "Error reading %s: %s", file_path, strerror(errno));
+    return SPARSE_FAILED;
+  }
+  int probe = -1;
+  for (int i = run_count - 1; i >= 0 && probe < 0; i--) {
+    if (runs[i].end < st.st_size && collapsible_bytes(fd, runs[i].start, runs[i].end) > 0)
+      probe = i;
+  }
+
+  off_t collapsed = 0;
+  if (probe >= 0) {
+    int error = collapse_range(fd, runs[probe].start, runs[probe].end, separator);
+    if (error == EOPNOTSUPP)
+      return SPARSE_COMPACT;
+    struct stat after;
+    if (error == 0 && fstat(fd, &after) != 0)
+      error = errno;
+    if (error) {
+      snprintf(err, err_len, "Unable to cut removed entries out of %s: %s", file_path, strerror(error));
+      return SPARSE_FAILED;
+    }
+    collapsed = st.st_size - after.st_size;
+  }
+
+  for (int i = run_count - 1; i >= 0; i--) {
+    if (i == probe)
+      continue;
+    off_t shift = i > probe ? collapsed : 0;
+    int error = cut_range(fd, runs[i].start - shift, runs[i].end - shift, separator);
+    if (error == EOPNOTSUPP) // cannot collapse after all, the run becomes padding
+      error = pad_range(fd, runs[i].start - shift, runs[i].end - shift, separator);
+    if (error) {
+      snprintf(err, err_len, "Unable to cut removed entries out of %s: %s. Some were removed", file_path,
+               strerror(error));
+      return SPARSE_FAILED;
+    }
+  }
+  return SPARSE_CLEANED;
+}
+
+// Sparse mode: cut the runs of removed records out of the log file in place, so the
+// cost follows the amount of noise rather than the size of the file. Files with too
+// many runs, with runs too short for most of their bytes to be collapsed, or on file
+// systems that cannot collapse, are left to be compacted; as the removed entries may
+// have been echoed by then, settings->quiet is set for that.
+static SparseResult clean_sparse(const char *file_path, const Config *config, Settings *settings, CleanStats *stats,
+                                 char *err, size_t err_len) {
+  Reader *reader = reader_open(file_path, config->line_separator);
+  if (reader == NULL) {
+    snprintf(err, err_len, "Error opening %s: %s", file_path, strerror(errno));
+    return SPARSE_FAILED;
+  }
+  MatchState *state = match_state_new(config);
+  Range *runs = NULL;
+  runs = m_alloc(runs, SPARSE_MAX_RUNS * sizeof(Range), "removed runs");
+  if (state == NULL || runs == NULL) {
+    snprintf(err, err_len, "Out of memory cleaning %s", file_path);
+    free(runs);
+    if (state != NULL)
+      match_state_free(state);
+    reader_close(reader);
+    return SPARSE_FAILED;
+  }
+
+  memset(stats, 0, sizeof(CleanStats));
+  if (settings->counters) {
+    perf_phase_init(&stats->scan, settings->counters);
+    perf_phase_init(&stats->write, settings->counters);
+    perf_phase_begin(&stats->scan);
+  }
+  int run_count;
+  SparseResult result = SPARSE_CLEANED;
+  if (!find_runs(reader, config, state, stats, runs, &run_count) ||
+      (run_count > 0 && mostly_padding(reader->fd, runs, run_count, reader_offset(reader)))) {
+    result = SPARSE_COMPACT;
+  } else if (reader->error) {
+    snprintf(err, err_len, "Error reading %s: %s", file_path, strerror(reader->error));
+    result = SPARSE_FAILED;
+  }
+
+  // the removed entries are saved before the log file loses them
+  Output *outputs = NULL;
+  int output_count = 0;
+  if (result == SPARSE_CLEANED && run_count > 0) {
+    outputs = open_outputs(file_path, config, *settings, false, &output_count, err, err_len);
+    if (outputs == NULL) {
+      result = SPARSE_FAILED;
+    } else {
+      for (int i = 1; settings->counters && i < output_count; i++)
+        outputs[i].writer->phase = &stats->write;
+      save_runs(reader, config, state, runs, run_count, outputs, *settings);
+      settings->quiet = true;
+      for (int i = 1; i < output_count; i++)
+        writer_flush(outputs[i].writer);
+    }
+  }
+  // as when compacting, the scan ends with the last flush, less the time spent
+  // writing; cutting the runs out counts as writing
+  if (settings->counters) {
+    perf_phase_end(&stats->scan);
+    perf_phase_subtract(&stats->scan, &stats->write);
+  }
+
+  if (outputs != NULL) {
+    bool sync = !settings->no_fsync;
+    int error = reader->error;
+    for (int i = 1; error == 0 && i < output_count; i++)
+      error = commit_output(&outputs[i], sync, err, err_len) ? 0 : EIO;
+    if (error == 0 && sync && output_count > 1)
+      error = sync_directory(file_path);
+
+    int fd = error == 0 ? open(file_path, O_RDWR | O_CLOEXEC) : -1;
+    if (error == 0 && fd < 0)
+      error = errno;
+    if (error) {
+      if (error != EIO)
+        snprintf(err, err_len, "Unable to save the removed entries of %s: %s", file_path, strerror(error));
+      result = SPARSE_FAILED;
+    } else {
+      if (settings->counters)
+        perf_phase_begin(&stats->write);
+      result = cut_runs(fd, runs, run_count, config->line_separator, file_path, err, err_len);
+      if (settings->counters)
+        perf_phase_end(&stats->write);
+      if (result == SPARSE_CLEANED && sync && fdatasync(fd) != 0) {
+        snprintf(err, err_len, "Unable to sync %s: %s", file_path, strerror(errno));
+        result = SPARSE_FAILED;
+      }
+    }
+    if (fd >= 0)
+      close(fd);
+    // compaction writes the removed files again
+    discard_outputs(outputs, output_count, result != SPARSE_COMPACT);
+  }
+
+  stats->sparse = result == SPARSE_CLEANED;
+  free(runs);
+  match_state_free(state);
+  reader_close(reader);
+  return result;
+}
+
+// The removed outputs of a live clean. They are committed, so named and on disk, before
+// the first in place write overwrites any of the records they hold, and flushed and
+// synced again before each later one, so an interrupted run loses no entry.
+typedef struct {
+  Output *outputs;
+  int output_count;
+  bool sync;
+  bool committed;
+  bool failed; // err holds why
+  char *err;
+  size_t err_len;
+} LiveSave;
+
+// Called before each in place write, and once more at the end. 0, or EIO once saving failed.
+static int save_live_removed(void *context) {
+  LiveSave *save = context;
+  if (save->failed)
+    return EIO;
+  const char *file_path = save->outputs[0].path;
+  for (int i = 1; i < save->output_count; i++) {
+    Output *output = &save->outputs[i];
+    if (!save->committed) {
+      if (!commit_output(output, save->sync, save->err, save->err_len)) {
+        save->failed = true;
+        return EIO;
+      }
+      continue;
+    }
+    writer_flush(output->writer);
+    int error = output->writer->error;
+    if (error == 0 && save->sync && fdatasync(output->writer->fd) != 0)
+      error = errno;
+    if (error) {
+      snprintf(save->err, save->err_len, "Unable to save %s: %s", output->path, strerror(error));
+      save->failed = true;
+      return EIO;
+    }
+  }
+  int error;
+  if (!save->committed && save->sync && save->output_count > 1 && (error = sync_directory(file_path)) != 0) {
+    snprintf(save->err, save->err_len, "Unable to save the removed entries of %s: %s", file_path, strerror(error));
+    save->failed = true;
+    return EIO;
+  }
+  save->committed = true;
+  return 0;
+}
+
+// Save the rest of the removed records, then close the gap they left in the live log
+// file. The records handled before a read error are saved and their gap closed all the
+// same. When saving them failed, or an in place write did, the gap is left open: the
+// records in it were not overwritten, so the file holds some records twice but loses
+// none.
+static bool finish_live(Reader *reader, Output *outputs, int output_count, LiveSave *save, off_t kept,
+                        off_t scanned, char separator, char *err, size_t err_len) {
+  const char *file_path = outputs[0].path;
+  int read_error = reader->error;
+  reader_close(reader);
+
+  Writer *writer = outputs[0].writer;
+  bool ok = save_live_removed(save) == 0; // err says why otherwise
+  int error = 0;
+  if (ok && writer->error == 0 && save->sync && fdatasync(writer->fd) != 0)
+    writer->error = errno;
+  if (ok && writer->error) {
+    snprintf(err, err_len, "Error moving entries within %s: %s. Entries may appear twice in it", file_path,
+             strerror(writer->error));
+    ok = false;
+  } else if (ok && ((error = remove_range(writer->fd, kept, scanned, separator)) != 0 ||
+                    (save->sync && fdatasync(writer->fd) != 0 && (error = errno) != 0))) {
+    snprintf(err, err_len, "Unable to remove the cleaned entries from %s: %s. Entries may appear twice in it",
+             file_path, strerror(error));
+    ok = false;
+  } else if (ok && read_error) {
+    snprintf(err, err_len, "Error reading %s: %s", file_path, strerror(read_error));
+    ok = false;
+  }
+  discard_outputs(outputs, output_count, true);
+  return ok;
+}
+
+bool clean_file(const char *file_path, const Config *config, Settings settings, CleanStats *stats, char *err,
+                size_t err_len) {
+  // extraction is cleaning that saves the removed records and keeps the log file
+  if (settings.extract) {
+    settings.saveRemovedItems = true;
+    settings.quiet = true;
+    settings.live = false;
+    settings.sparse = false;
+  }
+  if (settings.sparse && !settings.live) {
+    SparseResult result = clean_sparse(file_path, config, &settings, stats, err, err_len);
+    if (result != SPARSE_COMPACT)
+      return result == SPARSE_CLEANED;
+  }
+
+  Reader *reader = reader_open(file_path, config->line_separator);
+  if (reader == NULL) {
+    snprintf(err, err_len, "Error opening %s: %s", file_path, strerror(errno));
+    return false;
+  }
+
+  int output_count;
+  Output *outputs = open_outputs(file_path, config, settings, !settings.extract, &output_count, err, err_len);
+  if (outputs == NULL) {
+    reader_close(reader);
+    return false;
+  }
+  Writer *cleaned_writer = outputs[0].writer;
+  LiveSave live_save = {outputs, output_count, !settings.no_fsync, false, false, err, err_len};
+  if (settings.live) {
+    cleaned_writer->before_write = save_live_removed;
+    cleaned_writer->before_write_context = &live_save;
+  }
+
+  MatchState *match_state = match_state_new(config);
+  if (match_state == NULL) {
+    snprintf(err, err_len, "Out of memory cleaning %s", file_path);
+    discard_outputs(outputs, output_count, false);
+    reader_close(reader);
+    return false;
+  }
+  memset(stats, 0, sizeof(CleanStats));
+  if (settings.counters) {
+    perf_phase_init(&stats->scan, settings.counters);
+    perf_phase_init(&stats->write, settings.counters);
+    for (int i = settings.extract ? 1 : 0; i < output_count; i++)
+      outputs[i].writer->phase = &stats->write;
+    perf_phase_begin(&stats->scan);
+  }
+
+  // a record is one line, or with record_start set, a start line plus its continuation
+  // lines. It is matched and written out by length, line endings included.
+  // In live mode the kept records are moved down within the log file, and once the
+  // end is reached, further passes pick up the records appended meanwhile.
+  Record record;
+  off_t scanned = 0;        // live: end of the records handled so far
+  off_t kept = 0;           // live: end of the kept records moved down so far
+  off_t padding_start = -1; // live: start of the padding met before anything moved
+  bool moving = false;
+  for (int pass = 0; pass < (settings.live ? LIVE_MAX_PASSES : 1); pass++) {
+    off_t pass_start = scanned;
+    while (reader_next_record(reader, config->record_start, config->record_start_len, &record)) {
+      bool padding = record.content_len > 0 && is_padding(record.data, record.content_len);
+      if (settings.live && padding_start >= 0 && record.content_len > 0 && !padding) {
+        // padding an earlier live run left at the end, with entries appended after
+        // it since, is collapsed before anything moves, so the file shrinks
+        off_t start = padding_start;
+        padding_start = -1;
+        if (collapsible_bytes(cleaned_writer->fd, start, scanned) > 0) {
+          int error = collapse_range(cleaned_writer->fd, start, scanned, config->line_separator);
+          if (error == 0) {
+            // what is left of it is read again, as padding
+            scanned = kept = start;
+            reader_seek(reader, start);
+            continue;
+          }
+          if (error != EOPNOTSUPP) {
+            cleaned_writer->error = error;
+            break;
+          }
+        }
+      }
+      // the last line of a live log may still be being written, and with record_start,
+      // the last record may still get continuation lines: it is left for later
+      if (settings.live && (record.len == record.content_len ||
+                            (config->record_start != NULL && reader->eof && reader->start == reader->end)))
+        break;
+      scanned += record.len;
+      // ignore empty strings, and drop the padding left by in place runs. Live, an
+      // empty line stays where it is until an entry before it is removed, so a gap
+      // always starts with a whole entry and has room for a padding line
+      if (record.content_len == 0) {
+        if (settings.live && kept == scanned - (off_t)record.len && padding_start < 0)
+          kept = scanned;
+        continue;
+      }
+      if (padding) {
+        if (settings.live && kept == scanned - (off_t)record.len)
+          padding_start = kept;
+        continue;
+      }
+
+      int identifier = matching_identifier(record.data, record.content_len, config, match_state);
+      if (identifier >= 0) {
+        if (settings.saveRemovedItems)
+          save_removed(outputs, config, identifier, &record);
+        if (!settings.quiet)
+          echo_removed(&record);
+        stats->removed_entries++;
+        stats->removed_bytes += record.len;
+        continue;
+      }
+
+      stats->kept_entries++;
+      stats->kept_bytes += record.len;
+      if (settings.extract)
+        continue;
+      if (settings.live) {
+        // records stay where they are until the first one is removed
+        if (kept == scanned - (off_t)record.len) {
+          kept = scanned;
+          continue;
+        }
+        if (!moving)
+          writer_seek(cleaned_writer, kept);
+        moving = true;
+        kept += record.len;
+      }
+      writer_write(cleaned_writer, record.data, record.len);
+    }
+    if (!settings.live || scanned == pass_start || cleaned_writer->error)
+      break;
+    reader_seek(reader, scanned);
+  }
+
+  match_state_free(match_state);
+
+  for (int i = settings.extract ? 1 : 0; i < output_count; i++)
+    writer_flush(outputs[i].writer);
+  // the scan phase ends once the last buffered output is flushed, less the time spent writing
+  if (settings.counters) {
+    perf_phase_end(&stats->scan);
+    perf_phase_subtract(&stats->scan, &stats->write);
+  }
+  if (settings.live)
+    return finish_live(reader, outputs, output_count, &live_save, kept, scanned, config->line_separator, err, err_len);
+
+  bool ok = true;
+  if (reader->error) {
+    snprintf(err, err_len, "Error reading %s: %s", file_path, strerror(reader->error));
+    ok = false;
+  }
+  reader_close(reader);
+
+  // The removed entries are on disk, and named, before the log file loses them, and
+  // the cleaned data is on disk before it replaces the log file. Otherwise a crash
+  // can leave a renamed but empty log file.
+  bool sync = !settings.no_fsync;
+  for (int i = 1; ok && i < output_count; i++)
+    ok = commit_output(&outputs[i], sync, err, err_len);
+  int error = 0;
+  if (ok && sync && output_count > 1 && (error = sync_directory(file_path)) != 0) {
+    snprintf(err, err_len, "Unable to save the removed entries of %s: %s", file_path, strerror(error));
+    ok = false;
+  }
+  if (ok && settings.extract) { // the log file stays as it is
+    discard_outputs(outputs, output_count, true);
+    return true;
+  }
+  if (ok)
+    ok = commit_output(&outputs[0], sync, err, err_len);
+  if (!ok) {
+    discard_outputs(outputs, output_count, false);
+    return false;
+  }
+
+  // the log file is replaced by now, so the removed entries are kept whatever happens
+  if (sync && (error = sync_directory(file_path)) != 0) {
+    snprintf(err, err_len, "Cleaned %s, but could not sync its directory: %s", file_path, strerror(error));
+    ok = false;
+  }
+  discard_outputs(outputs, output_count, true);
+  return ok;
+}
@@ -0,0 +1,52 @@
+#ifndef CLEAN_H
+#define CLEAN_H
+
+#include "config.h"
+#include "perfcount.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// live mode: passes over the records appended while cleaning, before the rest is
+// left for the next run
+#define LIVE_MAX_PASSES 16
+// sparse mode: most runs of removed records cut out in place, files with more are
+// compacted instead
+#define SPARSE_MAX_RUNS 1024
+
+typedef struct {
+  char **file_paths; // the log files to clean, each on its own: one failing does not stop the others
+  int file_count;
+  char *config_file;
+  bool saveRemovedItems;
+  bool quiet; // don't echo removed entries to stdout
+  bool daemon;
+  char *socket_path;
+  int threads;
+  bool dry_run;          // report what would be removed without cleaning
+  double sample_percent; // share of the file a dry run reads, 100 reads it all
+  bool perf_counters;
+  bool live;             // clean in place, keeping what the log's owner appends meanwhile
+  bool sparse;           // cut the runs of removed entries out in place instead of rewriting the file
+  bool index;            // with saveRemovedItems, write which identifier removed each entry to a .idx file
+  bool extract;          // only save the matching entries, to extracted_ files, leaving the log file as it is
+  bool no_fsync;         // skip fdatasync and directory fsync, the outputs may not survive a crash
+  PerfCounters *counters; // open while perf_counters is set and the counters are usable, else NULL
+} Settings;
+
+typedef struct {
+  size_t kept_entries;
+  size_t removed_entries;
+  size_t kept_bytes;
+  size_t removed_bytes;
+  bool sparse; // cut out in place by sparse mode, the kept records were not written
+  // with settings.counters, the record loop and the output writes within it
+  PerfPhase scan;
+  PerfPhase write;
+} CleanStats;
+
+// Clean one log file. On failure err describes it and the log file is left as it was,
+// unless only syncing its directory after the replacement failed.
+bool clean_file(const char *file_path, const Config *config, Settings settings, CleanStats *stats, char *err,
+                size_t err_len);
+
+#endif
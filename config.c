@@ -0,0 +1,574 @@
+#include "config.h"
+#include "cJSON.h"
+#include "dfa.h"
+#include "util.h"
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool parse_item(const cJSON *json_item, Item *item, const char *log_file_name, int *regex_count, char *err,
+                       size_t err_len);
+static bool parse_bucket(const cJSON *bucket, Config *config, int *index, char *err, size_t err_len);
+static bool parse_name(const cJSON *name, const Config *config, Identifier *identifier, char *err, size_t err_len);
+
+// Describe what is wrong with the config in err, for the caller to report
+static bool fail(char *err, size_t err_len, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  vsnprintf(err, err_len, format, args);
+  va_end(args);
+  return false;
+}
+
+static bool out_of_memory(char *err, size_t err_len) {
+  return fail(err, err_len, "Out of memory loading the config");
+}
+
+// Parse the config text, checking it has a 'files' object
+static ConfigStatus parse_root(const char *json, size_t len, cJSON **root, char *err, size_t err_len) {
+  if (len == 0) {
+    fail(err, err_len, "No config set");
+    return CONFIG_INVALID;
+  }
+
+  const char *parse_end = NULL;
+  *root = cJSON_ParseWithLengthOpts(json, len, &parse_end, false);
+  if (!*root) {
+    fail(err, err_len, "Parse error at offset %zu of the config", parse_end ? (size_t)(parse_end - json) : len);
+    return CONFIG_INVALID;
+  }
+
+  cJSON *files = cJSON_GetObjectItemCaseSensitive(*root, "files");
+  if (!cJSON_IsObject(files)) {
+    fail(err, err_len, "Invalid 'files' object.");
+    cJSON_Delete(*root);
+    return CONFIG_INVALID;
+  }
+  return CONFIG_OK;
+}
+
+// Read and parse the config file
+static ConfigStatus read_config(const char *config_file, cJSON **root, char *err, size_t err_len) {
+  FILE *fp = fopen(config_file, "r");
+  if (!fp) {
+    fail(err, err_len, "Error: Unable to open the file %s. Check spelling and that it exists.", config_file);
+    return CONFIG_UNREADABLE;
+  }
+
+  char json_string[MAX_CONFIG_FILE_SIZE];
+  size_t len = fread(json_string, 1, sizeof(json_string), fp);
+  fclose(fp);
+
+  if (len == 0) {
+    fail(err, err_len, "No config set in config file '%s'", config_file);
+    return CONFIG_INVALID;
+  }
+  return parse_root(json_string, len, root, err, err_len);
+}
+
+// The identifier nodes of a section and of the sections it includes, in order
+typedef struct {
+  const cJSON **nodes;
+  int count;
+  const char **included; // sections already collected, so each is merged once
+  int included_count;
+} IdentifierList;
+
+static bool append_node(const void ***list, int *count, const void *node, char *err, size_t err_len) {
+  const void **grown = realloc(*list, (*count + 1) * sizeof(void *));
+  if (grown == NULL)
+    return out_of_memory(err, err_len);
+  grown[(*count)++] = node;
+  *list = grown;
+  return true;
+}
+
+// Collect the identifiers of a section, followed by those of each section named in
+// its "include", recursively. chain holds the sections being included, to spot cycles.
+static bool collect_identifiers(const cJSON *files, const cJSON *section, const char **chain, int depth,
+                                IdentifierList *list, char *err, size_t err_len) {
+  for (int i = 0; i < depth; i++) {
+    if (strcmp(chain[i], section->string) == 0) {
+      size_t used = snprintf(err, err_len, "Sections in config include each other:");
+      for (int j = i; j < depth && used < err_len; j++)
+        used += snprintf(err + used, err_len - used, " %s ->", chain[j]);
+      if (used < err_len)
+        snprintf(err + used, err_len - used, " %s", section->string);
+      return false;
+    }
+  }
+  if (depth == MAX_INCLUDE_DEPTH)
+    return fail(err, err_len, "Sections in config can only include each other %d deep, at %s", MAX_INCLUDE_DEPTH,
+                section->string);
+  for (int i = 0; i < list->included_count; i++) {
+    if (strcmp(list->included[i], section->string) == 0)
+      return true;
+  }
+  chain[depth] = section->string;
+  if (!append_node((const void ***)&list->included, &list->included_count, section->string, err, err_len))
+    return false;
+
+  const cJSON *array = cJSON_IsObject(section) ? cJSON_GetObjectItemCaseSensitive(section, "identifiers") : section;
+  const cJSON *identifier;
+  cJSON_ArrayForEach(identifier, array) {
+    if (!append_node((const void ***)&list->nodes, &list->count, identifier, err, err_len))
+      return false;
+  }
+
+  const cJSON *include = cJSON_IsObject(section) ? cJSON_GetObjectItemCaseSensitive(section, "include") : NULL;
+  if (include == NULL)
+    return true;
+  if (!cJSON_IsArray(include))
+    return fail(err, err_len, "'include' for %s in config must be an array of section names", section->string);
+  const cJSON *name;
+  cJSON_ArrayForEach(name, include) {
+    const cJSON *included = cJSON_IsString(name) ? cJSON_GetObjectItemCaseSensitive(files, name->valuestring) : NULL;
+    if (included == NULL)
+      return fail(err, err_len, "'include' for %s in config names a section that does not exist", section->string);
+    if (!collect_identifiers(files, included, chain, depth + 1, list, err, err_len))
+      return false;
+  }
+  return true;
+}
+
+// Fill in the identifiers of config from the nodes collected for its section
+static bool parse_identifiers(Config *config, const IdentifierList *list, char *err, size_t err_len) {
+  const char *log_file_name = config->log_file;
+  int size = list->count;
+  if (size <= 0) // error in config
+    return fail(err, err_len, "No identifier items set for %s in config", log_file_name);
+
+  config->identifiers = NULL;
+  config->identifiers = m_alloc(config->identifiers, size * sizeof(Identifier *), "identifiers list");
+  if (config->identifiers == NULL)
+    return out_of_memory(err, err_len);
+  memset(config->identifiers, 0, size * sizeof(Identifier *));
+  config->identifier_count = size;
+
+  for (int i = 0; i < size; i++) {
+
+    // an identifier is the item array itself, or an object holding "items", the
+    // "bucket" its removed entries are written to and its "name"
+    const cJSON *inner_array = list->nodes[i];
+    const cJSON *name = NULL;
+    int bucket = -1;
+    if (cJSON_IsObject(inner_array)) {
+      name = cJSON_GetObjectItemCaseSensitive(inner_array, "name");
+      if (!parse_bucket(cJSON_GetObjectItemCaseSensitive(inner_array, "bucket"), config, &bucket, err, err_len))
+        return false;
+      inner_array = cJSON_GetObjectItemCaseSensitive(inner_array, "items");
+    }
+    if (!cJSON_IsArray(inner_array))
+      return fail(err, err_len,
+                  "Identifiers for %s in config must be arrays of items, or objects with an 'items' array",
+                  log_file_name);
+
+    Identifier *identifier = NULL;
+    identifier = m_alloc(identifier, sizeof(Identifier), "config identifier");
+    if (identifier == NULL)
+      return out_of_memory(err, err_len);
+    config->identifiers[i] = identifier;
+
+    int inner_size = cJSON_GetArraySize(inner_array);
+    identifier->length = 0;
+    identifier->required = 0;
+    identifier->forbidden = 0;
+    identifier->bucket = bucket;
+    identifier->name = NULL;
+    identifier->items = NULL;
+    if (!parse_name(name, config, identifier, err, err_len))
+      return false;
+    if (inner_size <= 0)
+      continue;
+    if (inner_size > MAX_IDENTIFIER_ITEMS)
+      return fail(err, err_len, "Identifiers for %s in config are limited to %d items", log_file_name,
+                  MAX_IDENTIFIER_ITEMS);
+
+    // zeroed, so a half parsed identifier can be freed
+    identifier->items = m_alloc(identifier->items, inner_size * sizeof(Item), "identifier items");
+    if (identifier->items == NULL)
+      return out_of_memory(err, err_len);
+    memset(identifier->items, 0, inner_size * sizeof(Item));
+    identifier->length = inner_size;
+
+    // regex items go last so the cheaper literal items rule out most entries first
+    int literals = 0;
+    cJSON *item;
+    cJSON_ArrayForEach(item, inner_array) {
+      if ((!cJSON_IsObject(item) || !cJSON_HasObjectItem(item, "regex")) &&
+          !parse_item(item, &identifier->items[literals++], log_file_name, &config->regex_count, err, err_len))
+        return false;
+    }
+    int regexes = literals;
+    cJSON_ArrayForEach(item, inner_array) {
+      if (cJSON_IsObject(item) && cJSON_HasObjectItem(item, "regex") &&
+          !parse_item(item, &identifier->items[regexes++], log_file_name, &config->regex_count, err, err_len))
+        return false;
+    }
+
+    for (int j = 0; j < inner_size; j++) {
+      if (identifier->items[j].negate)
+        identifier->forbidden |= UINT64_C(1) << j;
+      else
+        identifier->required |= UINT64_C(1) << j;
+    }
+  }
+  return true;
+}
+
+// Build the Config for one section of the 'files' object. On error, describes it in
+// err and returns NULL.
+static Config *parse_section(const cJSON *files, const cJSON *log_file, char *err, size_t err_len) {
+  const char *log_file_name = log_file->string;
+  Config *config = NULL;
+
+  config = m_alloc(config, sizeof(Config), "config item");
+  if (config == NULL) {
+    out_of_memory(err, err_len);
+    return NULL;
+  }
+  memset(config, 0, sizeof(Config));
+  config->log_file = m_alloc(config->log_file, strlen(log_file->string) + 1, "log file name in config");
+  if (config->log_file == NULL) {
+    out_of_memory(err, err_len);
+    delete_config(config);
+    return NULL;
+  }
+  strcpy(config->log_file, log_file->string);
+
+  // a section is either the identifier array itself, or an object holding
+  // "identifiers", sections to "include" and optional settings such as "record_start"
+  config->field_separator = '\t';
+  config->line_separator = '\n';
+  if (cJSON_IsObject(log_file)) {
+    cJSON *field_separator = cJSON_GetObjectItemCaseSensitive(log_file, "field_separator");
+    if (cJSON_IsString(field_separator)) {
+      if (strlen(field_separator->valuestring) != 1) {
+        fail(err, err_len, "'field_separator' for %s in config must be a single character", log_file_name);
+        delete_config(config);
+        return NULL;
+      }
+      config->field_separator = field_separator->valuestring[0];
+    }
+    cJSON *line_separator = cJSON_GetObjectItemCaseSensitive(log_file, "line_separator");
+    if (cJSON_IsString(line_separator)) {
+      if (strlen(line_separator->valuestring) != 1) {
+        fail(err, err_len, "'line_separator' for %s in config must be a single character", log_file_name);
+        delete_config(config);
+        return NULL;
+      }
+      config->line_separator = line_separator->valuestring[0];
+    }
+
+    cJSON *record_start = cJSON_GetObjectItemCaseSensitive(log_file, "record_start");
+    if (cJSON_IsString(record_start) && record_start->valuestring[0] != '\0') {
+      config->record_start = m_alloc(config->record_start, strlen(record_start->valuestring) + 1,
+                                     "record start marker in config");
+      if (config->record_start == NULL) {
+        out_of_memory(err, err_len);
+        delete_config(config);
+        return NULL;
+      }
+      strcpy(config->record_start, record_start->valuestring);
+      config->record_start_len = strlen(config->record_start);
+    }
+  }
+
+  // included sections only add their identifiers, settings come from this section
+  const char *chain[MAX_INCLUDE_DEPTH];
+  IdentifierList list = {0};
+  bool ok = collect_identifiers(files, log_file, chain, 0, &list, err, err_len) &&
+            parse_identifiers(config, &list, err, err_len);
+  free(list.included);
+  free(list.nodes);
+  if (!ok) {
+    delete_config(config);
+    return NULL;
+  }
+
+  return config;
+}
+
+// Compile the section for log_file_name of an already parsed config
+static ConfigStatus section_from_root(const cJSON *root, const char *log_file_name, Config **config, char *err,
+                                      size_t err_len) {
+  cJSON *files = cJSON_GetObjectItemCaseSensitive(root, "files");
+  *config = NULL;
+
+  cJSON *log_file;
+  cJSON_ArrayForEach(log_file, files) {
+    if (strcmp(log_file->string, log_file_name) != 0)
+      continue;
+
+    *config = parse_section(files, log_file, err, err_len);
+    return *config ? CONFIG_OK : CONFIG_INVALID;
+  }
+
+  fail(err, err_len, "No '%s' section in config", log_file_name);
+  return CONFIG_NO_SECTION;
+}
+
+ConfigStatus load_config(const char *config_file, const char *log_file_name, Config **config, char *err,
+                         size_t err_len) {
+  cJSON *root = NULL;
+  ConfigStatus status = read_config(config_file, &root, err, err_len);
+  *config = NULL;
+  if (status != CONFIG_OK)
+    return status;
+  status = section_from_root(root, log_file_name, config, err, err_len);
+  cJSON_Delete(root);
+  return status;
+}
+
+ConfigStatus parse_config(const char *json, size_t len, const char *log_file_name, Config **config, char *err,
+                          size_t err_len) {
+  cJSON *root = NULL;
+  ConfigStatus status = parse_root(json, len, &root, err, err_len);
+  *config = NULL;
+  if (status != CONFIG_OK)
+    return status;
+  status = section_from_root(root, log_file_name, config, err, err_len);
+  cJSON_Delete(root);
+  return status;
+}
+
+// Load every section of the config file
+ConfigStatus load_config_set(const char *config_file, ConfigSet **set, char *err, size_t err_len) {
+  cJSON *root = NULL;
+  ConfigStatus status = read_config(config_file, &root, err, err_len);
+  *set = NULL;
+  if (status != CONFIG_OK)
+    return status;
+  cJSON *files = cJSON_GetObjectItemCaseSensitive(root, "files");
+
+  ConfigSet *configs = NULL;
+  configs = m_alloc(configs, sizeof(ConfigSet), "config set");
+  if (configs == NULL) {
+    out_of_memory(err, err_len);
+    cJSON_Delete(root);
+    return CONFIG_INVALID;
+  }
+  configs->count = 0;
+  configs->configs = NULL;
+  int size = cJSON_GetArraySize(files);
+  if (size > 0) {
+    configs->configs = m_alloc(configs->configs, size * sizeof(Config *), "config set");
+    if (configs->configs == NULL) {
+      out_of_memory(err, err_len);
+      delete_config_set(configs);
+      cJSON_Delete(root);
+      return CONFIG_INVALID;
+    }
+  }
+
+  cJSON *log_file;
+  cJSON_ArrayForEach(log_file, files) {
+    Config *config = parse_section(files, log_file, err, err_len);
+    if (config == NULL) {
+      delete_config_set(configs);
+      cJSON_Delete(root);
+      return CONFIG_INVALID;
+    }
+    configs->configs[configs->count++] = config;
+  }
+
+  cJSON_Delete(root);
+  *set = configs;
+  return CONFIG_OK;
+}
+
+const Config *find_config(const ConfigSet *set, const char *log_file_name) {
+  for (int i = 0; i < set->count; i++) {
+    if (strcmp(set->configs[i]->log_file, log_file_name) == 0)
+      return set->configs[i];
+  }
+  return NULL;
+}
+
+// Free the memory allocated to config, which may be only partly built
+void delete_config(Config *config) {
+  for (int i = 0; i < config->identifier_count; i++) {
+    if (config->identifiers[i] == NULL)
+      continue;
+    for (int j = 0; j < config->identifiers[i]->length; j++) {
+      free(config->identifiers[i]->items[j].text);
+      free(config->identifiers[i]->items[j].key);
+      if (config->identifiers[i]->items[j].dfa)
+        dfa_free(config->identifiers[i]->items[j].dfa);
+    }
+    free(config->identifiers[i]->items);
+    free(config->identifiers[i]->name);
+    free(config->identifiers[i]);
+  }
+  for (int i = 0; i < config->bucket_count; i++)
+    free(config->buckets[i]);
+  free(config->buckets);
+  free(config->log_file);
+  free(config->record_start);
+  free(config->identifiers);
+  free(config);
+}
+
+void delete_config_set(ConfigSet *set) {
+  for (int i = 0; i < set->count; i++)
+    delete_config(set->configs[i]);
+  free(set->configs);
+  free(set);
+}
+
+
+// An item is either a plain string searched for anywhere in the entry, or an object
+// { "text": "...", "field": n, "anchor": "prefix" | "suffix" | "exact",
+//   "icase": true, "not": true }. An object may hold a "regex" instead of "text", and
+// a JSON "key" path such as "http.status" in place of "field".
+static bool parse_item(const cJSON *json_item, Item *item, const char *log_file_name, int *regex_count, char *err,
+                       size_t err_len) {
+  item->dfa = NULL;
+  item->regex_slot = -1;
+  item->field = 0;
+  item->key = NULL;
+  item->key_len = 0;
+  item->anchor = ANCHOR_NONE;
+  item->icase = false;
+  item->negate = false;
+
+  const cJSON *text = json_item;
+  const cJSON *regex = NULL;
+  if (cJSON_IsObject(json_item)) {
+    text = cJSON_GetObjectItemCaseSensitive(json_item, "text");
+    regex = cJSON_GetObjectItemCaseSensitive(json_item, "regex");
+    if (regex != NULL) {
+      if (text != NULL || cJSON_HasObjectItem(json_item, "anchor"))
+        return fail(err, err_len, "Regex items for %s in config cannot also set 'text' or 'anchor'", log_file_name);
+      text = regex;
+    }
+
+    const cJSON *field = cJSON_GetObjectItemCaseSensitive(json_item, "field");
+    if (field != NULL) {
+      if (!cJSON_IsNumber(field) || field->valueint < 1)
+        return fail(err, err_len, "Item 'field' for %s in config must be a number from 1", log_file_name);
+      item->field = field->valueint;
+    }
+
+    const cJSON *key = cJSON_GetObjectItemCaseSensitive(json_item, "key");
+    if (key != NULL) {
+      const char *path = cJSON_IsString(key) ? key->valuestring : NULL;
+      size_t path_len = path ? strlen(path) : 0;
+      if (path_len == 0 || path[0] == '.' || path[path_len - 1] == '.' || strstr(path, "..") != NULL)
+        return fail(err, err_len, "Item 'key' for %s in config must be a key path such as \"http.status\"",
+                    log_file_name);
+      if (field != NULL)
+        return fail(err, err_len, "Items for %s in config cannot set both 'field' and 'key'", log_file_name);
+      item->key = m_alloc(item->key, path_len + 1, "item key in config");
+      if (item->key == NULL)
+        return out_of_memory(err, err_len);
+      strcpy(item->key, path);
+      item->key_len = path_len;
+    }
+
+    const cJSON *anchor = cJSON_GetObjectItemCaseSensitive(json_item, "anchor");
+    if (anchor != NULL) {
+      if (!cJSON_IsString(anchor))
+        return fail(err, err_len, "Item 'anchor' for %s in config must be a string", log_file_name);
+      if (strcmp(anchor->valuestring, "prefix") == 0)
+        item->anchor = ANCHOR_PREFIX;
+      else if (strcmp(anchor->valuestring, "suffix") == 0)
+        item->anchor = ANCHOR_SUFFIX;
+      else if (strcmp(anchor->valuestring, "exact") == 0)
+        item->anchor = ANCHOR_EXACT;
+      else
+        return fail(err, err_len, "Unknown item anchor '%s' for %s in config", anchor->valuestring, log_file_name);
+    }
+
+    const cJSON *icase = cJSON_GetObjectItemCaseSensitive(json_item, "icase");
+    if (icase != NULL) {
+      if (!cJSON_IsBool(icase))
+        return fail(err, err_len, "Item 'icase' for %s in config must be true or false", log_file_name);
+      item->icase = cJSON_IsTrue(icase);
+    }
+
+    const cJSON *negate = cJSON_GetObjectItemCaseSensitive(json_item, "not");
+    if (negate != NULL) {
+      if (!cJSON_IsBool(negate))
+        return fail(err, err_len, "Item 'not' for %s in config must be true or false", log_file_name);
+      item->negate = cJSON_IsTrue(negate);
+    }
+  }
+
+  if (!cJSON_IsString(text))
+    return fail(err, err_len, "Identifier items for %s in config must be strings or objects with a 'text' string",
+                log_file_name);
+
+  item->text_len = strlen(text->valuestring);
+  item->text = NULL;
+  item->text = m_alloc(item->text, item->text_len + 1, "item string in config");
+  if (item->text == NULL)
+    return out_of_memory(err, err_len);
+  strcpy(item->text, text->valuestring);
+
+  if (regex != NULL) {
+    char regex_err[128];
+    item->dfa = dfa_compile(item->text, item->icase, regex_err, sizeof(regex_err));
+    if (item->dfa == NULL)
+      return fail(err, err_len, "Invalid regex '%s' for %s in config: %s", item->text, log_file_name, regex_err);
+    item->regex_slot = (*regex_count)++;
+    return true;
+  }
+
+  if (item->icase) {
+    for (char *c = item->text; *c; c++) {
+      if (*c >= 'A' && *c <= 'Z')
+        *c |= 0x20;
+    }
+  }
+  return true;
+}
+
+// Index of the named bucket in config->buckets, added on first use. Identifiers
+// without a bucket get -1. The name becomes part of a file name.
+static bool parse_bucket(const cJSON *bucket, Config *config, int *index, char *err, size_t err_len) {
+  *index = -1;
+  if (bucket == NULL)
+    return true;
+  if (!cJSON_IsString(bucket) || bucket->valuestring[0] == '\0' || strchr(bucket->valuestring, '/') != NULL)
+    return fail(err, err_len, "Identifier 'bucket' for %s in config must be a non-empty name without '/'",
+                config->log_file);
+
+  for (int i = 0; i < config->bucket_count; i++) {
+    if (strcmp(config->buckets[i], bucket->valuestring) == 0) {
+      *index = i;
+      return true;
+    }
+  }
+
+  char **buckets = realloc(config->buckets, (config->bucket_count + 1) * sizeof(char *));
+  if (buckets == NULL)
+    return out_of_memory(err, err_len);
+  config->buckets = buckets;
+  config->buckets[config->bucket_count] = NULL;
+  config->buckets[config->bucket_count] =
+      m_alloc(config->buckets[config->bucket_count], strlen(bucket->valuestring) + 1, "identifier bucket");
+  if (config->buckets[config->bucket_count] == NULL)
+    return out_of_memory(err, err_len);
+  strcpy(config->buckets[config->bucket_count], bucket->valuestring);
+  *index = config->bucket_count++;
+  return true;
+}
+
+// Optional name of an identifier. It becomes a field of the removed file index,
+// so it cannot hold a tab or a line break.
+static bool parse_name(const cJSON *name, const Config *config, Identifier *identifier, char *err, size_t err_len) {
+  if (name == NULL)
+    return true;
+  if (!cJSON_IsString(name) || name->valuestring[0] == '\0' || strpbrk(name->valuestring, "\t\r\n") != NULL)
+    return fail(err, err_len,
+                "Identifier 'name' for %s in config must be a non-empty string without tabs or line breaks",
+                config->log_file);
+  identifier->name = m_alloc(identifier->name, strlen(name->valuestring) + 1, "identifier name");
+  if (identifier->name == NULL)
+    return out_of_memory(err, err_len);
+  strcpy(identifier->name, name->valuestring);
+  return true;
+}
@@ -0,0 +1,83 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "dfa.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// program limitation: max config size of 4k
+#define MAX_CONFIG_FILE_SIZE 4096
+// program limitation: items of an identifier are tracked in a 64 bit mask
+#define MAX_IDENTIFIER_ITEMS 64
+// program limitation: how deep sections can include sections that include others
+#define MAX_INCLUDE_DEPTH 16
+
+typedef enum {
+  ANCHOR_NONE,   // anywhere in the searched text
+  ANCHOR_PREFIX, // searched text starts with the item
+  ANCHOR_SUFFIX, // searched text ends with the item
+  ANCHOR_EXACT   // searched text is the item
+} Anchor;
+
+typedef struct {
+  char *text;
+  size_t text_len;
+  int field;     // 1-based field to search within, 0 searches the whole entry
+  char *key;     // dot separated JSON key path whose value is searched, NULL for the whole entry
+  size_t key_len;
+  Anchor anchor;
+  bool icase;    // ASCII case-insensitive, text is stored lower-cased
+  bool negate;   // the entry must NOT contain the item
+  Dfa *dfa;       // compiled regex, NULL for text items
+  int regex_slot; // index of the regex's DfaCache in a MatchState
+} Item;
+
+typedef struct {
+  Item *items;
+  int length;
+  uint64_t required;  // bit per item that must be found
+  uint64_t forbidden; // bit per item that must not be found
+  int bucket;         // index into the Config's buckets, -1 for the shared removed file
+  char *name;         // tags its entries in removed file indexes, NULL to use its 1-based position
+} Identifier;
+
+typedef struct {
+  char *log_file;
+  char *record_start; // lines not starting with this belong to the previous record (NULL: one line per record)
+  size_t record_start_len;
+  char field_separator;
+  char line_separator;
+  Identifier **identifiers;
+  int identifier_count;
+  int regex_count;
+  char **buckets; // names of the separate removed files identifiers are routed to
+  int bucket_count;
+} Config;
+
+// All sections of a config file, for long running modes that serve any log file
+typedef struct {
+  Config **configs;
+  int count;
+} ConfigSet;
+
+typedef enum {
+  CONFIG_OK,
+  CONFIG_UNREADABLE, // the config file could not be opened
+  CONFIG_INVALID,    // the config is not valid JSON, breaks a rule or ran out of memory, described in err
+  CONFIG_NO_SECTION  // there is no section for the log file
+} ConfigStatus;
+
+// Compile the section for log_file_name from a config file, or from config text
+// already in memory. On failure err holds a description of what is wrong.
+ConfigStatus load_config(const char *config_file, const char *log_file_name, Config **config, char *err,
+                         size_t err_len);
+ConfigStatus parse_config(const char *json, size_t len, const char *log_file_name, Config **config, char *err,
+                          size_t err_len);
+ConfigStatus load_config_set(const char *config_file, ConfigSet **set, char *err, size_t err_len);
+
+void delete_config(Config *config);
+void delete_config_set(ConfigSet *set);
+const Config *find_config(const ConfigSet *set, const char *log_file_name);
+
+#endif
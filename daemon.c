@@ -0,0 +1,535 @@
+#define _GNU_SOURCE
+#include "daemon.h"
+#include "alloc.h"
+#include "clean.h"
+#include "config.h"
+#include "util.h"
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// Accepted connections waiting for a worker. push blocks while the queue is full,
+// which holds back accept() until the workers catch up.
+typedef struct {
+  int fds[DAEMON_QUEUE_SIZE];
+  int head;
+  int count;
+  bool closed;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+} JobQueue;
+
+typedef struct Daemon Daemon;
+
+typedef struct {
+  Daemon *daemon;
+  pthread_t thread;
+  int node; // NUMA node the worker runs on, -1 when not placed
+  // the daemon epoch this worker entered when it picked up the current ConfigSet,
+  // 0 while it holds none
+  _Atomic uint64_t epoch;
+} Worker;
+
+// A replaced ConfigSet, freed once no worker that might still use it is running
+typedef struct RetiredConfig {
+  ConfigSet *configs;
+  uint64_t epoch;
+  struct RetiredConfig *next;
+} RetiredConfig;
+
+struct Daemon {
+  JobQueue queue;
+  char *config_file;
+  // swapped as a whole on reload. Workers announce an epoch before loading it, so the
+  // reloader knows when nobody can still be using a replaced one.
+  _Atomic(ConfigSet *) configs;
+  _Atomic uint64_t epoch;
+  Worker *workers;
+  int worker_count;
+  RetiredConfig *retired; // only used by the reloader thread
+};
+
+// set from signal handlers and read by other threads, so lock-free atomics rather than sig_atomic_t
+static atomic_bool stopping = false;
+static atomic_bool reload_requested = false;
+
+static void on_stop_signal(int sig) {
+  (void)sig;
+  atomic_store(&stopping, true);
+}
+
+static void on_reload_signal(int sig) {
+  (void)sig;
+  atomic_store(&reload_requested, true);
+}
+
+static const ConfigSet *enter_config(Worker *worker) {
+  atomic_store(&worker->epoch, atomic_load(&worker->daemon->epoch));
+  return atomic_load(&worker->daemon->configs);
+}
+
+static void leave_config(Worker *worker) {
+  atomic_store(&worker->epoch, 0);
+}
+
+static void queue_push(JobQueue *queue, int fd) {
+  pthread_mutex_lock(&queue->lock);
+  while (queue->count == DAEMON_QUEUE_SIZE)
+    pthread_cond_wait(&queue->not_full, &queue->lock);
+  queue->fds[(queue->head + queue->count) % DAEMON_QUEUE_SIZE] = fd;
+  queue->count++;
+  pthread_cond_signal(&queue->not_empty);
+  pthread_mutex_unlock(&queue->lock);
+}
+
+// Next connection, or -1 once the queue is closed and empty
+static int queue_pop(JobQueue *queue) {
+  pthread_mutex_lock(&queue->lock);
+  while (queue->count == 0 && !queue->closed)
+    pthread_cond_wait(&queue->not_empty, &queue->lock);
+  int fd = -1;
+  if (queue->count > 0) {
+    fd = queue->fds[queue->head];
+    queue->head = (queue->head + 1) % DAEMON_QUEUE_SIZE;
+    queue->count--;
+    pthread_cond_signal(&queue->not_full);
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return fd;
+}
+
+static void queue_close(JobQueue *queue) {
+  pthread_mutex_lock(&queue->lock);
+  queue->closed = true;
+  pthread_cond_broadcast(&queue->not_empty);
+  pthread_mutex_unlock(&queue->lock);
+}
+
+static void send_all(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR)
+      continue;
+    if (sent <= 0)
+      return; // client has gone, nothing more to tell it
+    data += sent;
+    len -= sent;
+  }
+}
+
+static void reply(int fd, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void reply(int fd, const char *format, ...) {
+  char message[512];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+  if (len < 0)
+    return;
+  send_all(fd, message, (size_t)len < sizeof(message) ? (size_t)len : sizeof(message) - 1);
+}
+
+// Read one request line from the client, run the clean and send back its statistics
+static void handle_request(Worker *worker, int fd) {
+  char request[DAEMON_MAX_REQUEST];
+  size_t len = 0;
+  char *newline = NULL;
+  while (newline == NULL && len < sizeof(request) - 1) {
+    ssize_t got = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got <= 0)
+      break;
+    newline = memchr(request + len, '\n', got);
+    len += got;
+  }
+  if (newline == NULL) {
+    reply(fd, "ERROR incomplete request\n");
+    return;
+  }
+  *newline = '\0';
+
+  char *save = NULL;
+  char *path = strtok_r(request, "\t", &save);
+  const char *section = NULL;
+  Settings settings = {.saveRemovedItems = false, .quiet = true};
+  for (char *field = strtok_r(NULL, "\t", &save); field; field = strtok_r(NULL, "\t", &save)) {
+    if (strncmp(field, "section=", 8) == 0)
+      section = field + 8;
+    else if (strcmp(field, "retain") == 0)
+      settings.saveRemovedItems = true;
+    else if (strcmp(field, "no-fsync") == 0)
+      settings.no_fsync = true;
+    else if (strcmp(field, "live") == 0)
+      settings.live = true;
+    else if (strcmp(field, "sparse") == 0)
+      settings.sparse = true;
+    else if (strcmp(field, "index") == 0)
+      settings.index = true;
+    else if (strcmp(field, "extract") == 0)
+      settings.extract = true;
+    else {
+      reply(fd, "ERROR unknown option '%s'\n", field);
+      return;
+    }
+  }
+  if (path == NULL) {
+    reply(fd, "ERROR no log file given\n");
+    return;
+  }
+  if (section == NULL)
+    section = get_filename(path);
+
+  // the file is cleaned to the end with the rules it started with, even if the
+  // config is reloaded meanwhile
+  const ConfigSet *configs = enter_config(worker);
+  const Config *config = find_config(configs, section);
+  if (config == NULL) {
+    leave_config(worker);
+    reply(fd, "ERROR no config section '%s'\n", section);
+    return;
+  }
+
+  struct timespec started, finished;
+  clock_gettime(CLOCK_MONOTONIC, &started);
+  CleanStats stats;
+  char err[512];
+  bool cleaned = clean_file(path, config, settings, &stats, err, sizeof(err));
+  clock_gettime(CLOCK_MONOTONIC, &finished);
+  leave_config(worker);
+  if (!cleaned) {
+    // only this job fails, the worker carries on with the next one
+    printf("Failed to clean %s: %s\n", path, err);
+    fflush(stdout);
+    reply(fd, "ERROR %s\n", err);
+    return;
+  }
+  double seconds = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+
+  printf("Cleaned %s: kept %zu, removed %zu entries\n", path, stats.kept_entries, stats.removed_entries);
+  fflush(stdout);
+  reply(fd, "OK kept_entries=%zu removed_entries=%zu kept_bytes=%zu removed_bytes=%zu seconds=%.3f\n",
+        stats.kept_entries, stats.removed_entries, stats.kept_bytes, stats.removed_bytes, seconds);
+}
+
+static void *worker_main(void *arg) {
+  Worker *worker = arg;
+  // buffers are allocated by the worker cleaning the file, so they land on its node
+  if (worker->node >= 0)
+    numa_bind_thread(worker->node);
+  int fd;
+  while ((fd = queue_pop(&worker->daemon->queue)) >= 0) {
+    handle_request(worker, fd);
+    close(fd);
+  }
+  return NULL;
+}
+
+// Load the changed config in this thread, as a trial: the config layer reports a
+// broken or half written file as an error instead of exiting, so the running rules
+// are kept and the error printed. Only a config that loaded whole is swapped in, and
+// the one it replaces is retired until no worker can still hold it.
+static void reload_config(Daemon *daemon) {
+  ConfigSet *fresh;
+  char err[512];
+  RetiredConfig *retired = NULL;
+  retired = m_alloc(retired, sizeof(RetiredConfig), "retired config");
+  if (retired == NULL || load_config_set(daemon->config_file, &fresh, err, sizeof(err)) != CONFIG_OK) {
+    if (retired != NULL)
+      printf("%s\n", err);
+    printf("Config %s was not reloaded, keeping the current rules\n", daemon->config_file);
+    fflush(stdout);
+    free(retired);
+    return;
+  }
+
+  ConfigSet *old = atomic_exchange(&daemon->configs, fresh);
+  // workers that entered an epoch up to this one may still hold old
+  uint64_t epoch = atomic_fetch_add(&daemon->epoch, 1);
+
+  retired->configs = old;
+  retired->epoch = epoch;
+  retired->next = daemon->retired;
+  daemon->retired = retired;
+
+  printf("Reloaded config %s\n", daemon->config_file);
+  fflush(stdout);
+}
+
+// Free the replaced ConfigSets no running worker can be using
+static void reclaim_configs(Daemon *daemon, bool all) {
+  uint64_t oldest = UINT64_MAX;
+  for (int i = 0; i < daemon->worker_count && !all; i++) {
+    uint64_t epoch = atomic_load(&daemon->workers[i].epoch);
+    if (epoch != 0 && epoch < oldest)
+      oldest = epoch;
+  }
+
+  RetiredConfig **link = &daemon->retired;
+  while (*link) {
+    RetiredConfig *retired = *link;
+    if (all || retired->epoch < oldest) {
+      *link = retired->next;
+      delete_config_set(retired->configs);
+      free(retired);
+    } else {
+      link = &retired->next;
+    }
+  }
+}
+
+// Watch the config file and swap in a freshly loaded ConfigSet when it changes, or
+// on SIGHUP. Changes are picked up once the file has been quiet for RELOAD_SETTLE_MS.
+static void *reloader_main(void *arg) {
+  Daemon *daemon = arg;
+  const char *config_name = get_filename(daemon->config_file);
+
+  // editors often save by renaming a new file over the old one, so the directory is
+  // watched rather than the file itself
+  char dir[PATH_MAX];
+  size_t dir_len = config_name - daemon->config_file;
+  snprintf(dir, sizeof(dir), "%.*s", dir_len ? (int)dir_len : 1, dir_len ? daemon->config_file : ".");
+  int watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (watch_fd >= 0 && inotify_add_watch(watch_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    close(watch_fd);
+    watch_fd = -1;
+  }
+  if (watch_fd < 0) {
+    printf("Unable to watch %s for changes, reload with SIGHUP instead\n", daemon->config_file);
+    fflush(stdout);
+  }
+
+  bool changed = false;
+  while (!stopping) {
+    struct pollfd watch = {.fd = watch_fd, .events = POLLIN};
+    if (poll(&watch, 1, changed ? RELOAD_SETTLE_MS : 1000) > 0) {
+      char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+      ssize_t len;
+      while ((len = read(watch_fd, events, sizeof(events))) > 0) {
+        for (char *at = events; at < events + len;) {
+          struct inotify_event *event = (struct inotify_event *)at;
+          if (event->len > 0 && strcmp(event->name, config_name) == 0)
+            changed = true;
+          at += sizeof(struct inotify_event) + event->len;
+        }
+      }
+      continue;
+    }
+
+    if (atomic_exchange(&reload_requested, false) || changed) {
+      changed = false;
+      reload_config(daemon);
+    }
+    reclaim_configs(daemon, false);
+  }
+
+  if (watch_fd >= 0)
+    close(watch_fd);
+  return NULL;
+}
+
+static bool socket_address(const char *socket_path, struct sockaddr_un *addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(addr->sun_path)) {
+    printf("Socket path '%s' is too long\n", socket_path);
+    return false;
+  }
+  strcpy(addr->sun_path, socket_path);
+  return true;
+}
+
+// The listening socket, or -1 after saying why it could not be opened
+static int open_listen_socket(const char *socket_path) {
+  struct sockaddr_un addr;
+  if (!socket_address(socket_path, &addr))
+    return -1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    printf("Unable to create socket: %s\n", strerror(errno));
+    return -1;
+  }
+
+  // a socket file left behind by a daemon that is no longer running is replaced
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+    printf("A daemon is already listening on %s\n", socket_path);
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  unlink(socket_path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, DAEMON_QUEUE_SIZE) != 0) {
+    printf("Unable to listen on %s: %s\n", socket_path, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int run_daemon(const char *socket_path, char *config_file, int threads) {
+  ConfigSet *configs;
+  char err[512];
+  if (load_config_set(config_file, &configs, err, sizeof(err)) != CONFIG_OK) {
+    printf("%s\n", err);
+    return EXIT_FAILURE;
+  }
+  Worker *workers = NULL;
+  workers = m_alloc(workers, threads * sizeof(Worker), "worker threads");
+  int listen_fd = workers ? open_listen_socket(socket_path) : -1;
+  if (listen_fd < 0) {
+    free(workers);
+    delete_config_set(configs);
+    return EXIT_FAILURE;
+  }
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = on_stop_signal;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  action.sa_handler = on_reload_signal;
+  sigaction(SIGHUP, &action, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  Daemon daemon;
+  daemon.config_file = config_file;
+  atomic_init(&daemon.configs, configs);
+  atomic_init(&daemon.epoch, 1);
+  daemon.retired = NULL;
+  daemon.queue.head = 0;
+  daemon.queue.count = 0;
+  daemon.queue.closed = false;
+  pthread_mutex_init(&daemon.queue.lock, NULL);
+  pthread_cond_init(&daemon.queue.not_empty, NULL);
+  pthread_cond_init(&daemon.queue.not_full, NULL);
+
+  // signals are only handled by this thread, so the other threads are never interrupted
+  sigset_t handled_signals, previous;
+  sigemptyset(&handled_signals);
+  sigaddset(&handled_signals, SIGINT);
+  sigaddset(&handled_signals, SIGTERM);
+  sigaddset(&handled_signals, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &handled_signals, &previous);
+  daemon.worker_count = 0;
+  daemon.workers = workers;
+  // on multi-socket hosts, spread the workers round robin over the NUMA nodes
+  int nodes[MAX_NUMA_NODES];
+  int node_count = numa_nodes(nodes, MAX_NUMA_NODES);
+  for (int i = 0; i < threads; i++) {
+    daemon.workers[i].daemon = &daemon;
+    daemon.workers[i].node = node_count > 1 ? nodes[i % node_count] : -1;
+    atomic_init(&daemon.workers[i].epoch, 0);
+    if (pthread_create(&daemon.workers[i].thread, NULL, worker_main, &daemon.workers[i]) != 0) {
+      // serve with the workers that did start
+      printf("Unable to start worker thread %d of %d: %s\n", i + 1, threads, strerror(errno));
+      break;
+    }
+    daemon.worker_count++;
+  }
+  pthread_t reloader;
+  bool reloading = daemon.worker_count > 0 && pthread_create(&reloader, NULL, reloader_main, &daemon) == 0;
+  if (daemon.worker_count > 0 && !reloading)
+    printf("Unable to start config reload thread, %s will not be reloaded\n", config_file);
+  pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+  if (daemon.worker_count > 0) {
+    printf("log-cleaner daemon listening on %s with %d threads\n", socket_path, daemon.worker_count);
+    fflush(stdout);
+  } else {
+    atomic_store(&stopping, true);
+  }
+
+  while (!stopping) {
+    struct pollfd listener = {.fd = listen_fd, .events = POLLIN};
+    if (poll(&listener, 1, 1000) <= 0)
+      continue;
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd >= 0)
+      queue_push(&daemon.queue, fd);
+  }
+
+  // finish the jobs already accepted, then shut down
+  close(listen_fd);
+  unlink(socket_path);
+  queue_close(&daemon.queue);
+  for (int i = 0; i < daemon.worker_count; i++)
+    pthread_join(daemon.workers[i].thread, NULL);
+  if (reloading)
+    pthread_join(reloader, NULL);
+  free(daemon.workers);
+  pthread_mutex_destroy(&daemon.queue.lock);
+  pthread_cond_destroy(&daemon.queue.not_empty);
+  pthread_cond_destroy(&daemon.queue.not_full);
+  reclaim_configs(&daemon, true);
+  delete_config_set(atomic_load(&daemon.configs));
+
+  return daemon.worker_count > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int submit_to_daemon(const char *socket_path, const char *file_path, const Settings *settings) {
+  // the daemon has its own working directory, so send it an absolute path
+  char *path = realpath(file_path, NULL);
+  if (path == NULL) {
+    printf("Error opening file: %s\n", file_path);
+    return EXIT_FAILURE;
+  }
+  if (strpbrk(path, "\t\n")) {
+    printf("Log file paths sent to the daemon cannot contain tabs or newlines\n");
+    free(path);
+    return EXIT_FAILURE;
+  }
+
+  struct sockaddr_un addr;
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (!socket_address(socket_path, &addr) || fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    printf("Unable to connect to the daemon on %s\n", socket_path);
+    free(path);
+    return EXIT_FAILURE;
+  }
+
+  char request[PATH_MAX + 32];
+  int len = snprintf(request, sizeof(request), "%s%s%s%s%s%s%s\n", path, settings->saveRemovedItems ? "\tretain" : "",
+                     settings->index ? "\tindex" : "",
+                     settings->live ? "\tlive" : "", settings->sparse ? "\tsparse" : "",
+                     settings->extract ? "\textract" : "",
+                     settings->no_fsync ? "\tno-fsync" : "");
+  free(path);
+  signal(SIGPIPE, SIG_IGN);
+  send_all(fd, request, len);
+
+  char response[512];
+  size_t got = 0;
+  ssize_t n;
+  while (got < sizeof(response) - 1 && (n = recv(fd, response + got, sizeof(response) - 1 - got, 0)) != 0) {
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    got += n;
+  }
+  response[got] = '\0';
+  close(fd);
+
+  printf("%s", response);
+  return strncmp(response, "OK", 2) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,23 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "clean.h"
+#include <stdbool.h>
+
+// Requests are one line sent over the daemon's Unix socket, tab separated:
+//   <log_filepath>[\tsection=<config section>][\tretain][\tindex][\tlive][\tsparse][\textract][\tno-fsync]
+// and get a one line reply:
+//   OK kept_entries=<n> removed_entries=<n> kept_bytes=<n> removed_bytes=<n> seconds=<s>
+//   ERROR <message>
+// The section defaults to the log file's name, as on the command line.
+#define DAEMON_MAX_REQUEST 4096
+// accepted connections waiting for a free worker thread
+#define DAEMON_QUEUE_SIZE 256
+// a changed config is reloaded once it has not been written to for this long
+#define RELOAD_SETTLE_MS 200
+
+int run_daemon(const char *socket_path, char *config_file, int threads);
+// Send one log file to the daemon, with the settings that apply per request
+int submit_to_daemon(const char *socket_path, const char *file_path, const Settings *settings);
+
+#endif
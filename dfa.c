@@ -0,0 +1,754 @@
+#include "dfa.h"
+#include "alloc.h"
+#include "util.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// program limitation: patterns compile to at most 4096 NFA states and repeat counts
+// are at most 255, which bounds the work done per byte of a search
+#define DFA_MAX_NFA_STATES 4096
+#define DFA_MAX_REPEAT 255
+// the lazy DFA is flushed and rebuilt once it holds this many states
+#define DFA_CACHE_STATES 1024
+
+// NFA_MATCH_END ends an alternative anchored with '$', which only matches at the end of the text
+enum { NFA_SET, NFA_SPLIT, NFA_EMPTY, NFA_MATCH, NFA_MATCH_END };
+
+typedef struct {
+  int type;
+  int out;  // next state, for SET, SPLIT and EMPTY
+  int out2; // second branch of a SPLIT
+  uint64_t set[4];
+} NfaState;
+
+struct Dfa {
+  NfaState *states;
+  int count;
+  int cap;
+  int start;          // the alternatives anchored with '^', -1 when there are none
+  int floating_start; // the others, which may begin at any position, -1 when there are none
+  unsigned char classmap[256]; // byte -> equivalence class
+  unsigned char class_rep[256]; // class -> one of its bytes
+  int class_count;
+};
+
+struct DfaCache {
+  const Dfa *dfa;
+  int *trans;        // DFA_CACHE_STATES * class_count, -1 while not yet computed
+  int *member_start; // per state: offset of its NFA state list in members
+  int *member_count;
+  bool *accept;     // a match has been found
+  bool *accept_end; // a match is found if the text ends here
+  int *members;
+  size_t members_used;
+  size_t members_cap;
+  int *hash; // open addressing, 2 * DFA_CACHE_STATES slots of state index or -1
+  int state_count;
+  int start;
+  unsigned flushes;
+  // scratch space for building a state
+  int *scratch;
+  int scratch_len;
+  int *stack;
+  unsigned *mark;
+  unsigned generation;
+};
+
+// A partially built piece of NFA. 'out' is a list of unconnected exits, threaded
+// through the exit fields themselves and encoded as state * 2 + (0: out, 1: out2).
+typedef struct {
+  int start;
+  int out;
+} Frag;
+
+typedef struct {
+  Dfa *dfa;
+  const char *pattern;
+  size_t pos;
+  size_t end;
+  bool icase;
+  int depth;        // groups the parser is in
+  bool anchored_end; // the alternative just parsed ended with '$'
+  const char *error;
+} Parser;
+
+static Frag parse_alt(Parser *p);
+
+static void set_add(uint64_t *set, unsigned char c) {
+  set[c >> 6] |= UINT64_C(1) << (c & 63);
+}
+
+static bool set_has(const uint64_t *set, unsigned char c) {
+  return (set[c >> 6] >> (c & 63)) & 1;
+}
+
+static void set_add_range(uint64_t *set, unsigned char lo, unsigned char hi) {
+  for (int c = lo; c <= hi; c++)
+    set_add(set, (unsigned char)c);
+}
+
+static void set_invert(uint64_t *set) {
+  for (int i = 0; i < 4; i++)
+    set[i] = ~set[i];
+}
+
+static void set_fold(uint64_t *set) {
+  for (int c = 'a'; c <= 'z'; c++) {
+    if (set_has(set, (unsigned char)c) || set_has(set, (unsigned char)(c - 32))) {
+      set_add(set, (unsigned char)c);
+      set_add(set, (unsigned char)(c - 32));
+    }
+  }
+}
+
+static int new_state(Parser *p, int type) {
+  Dfa *dfa = p->dfa;
+  if (dfa->count >= DFA_MAX_NFA_STATES) {
+    p->error = "pattern is too large";
+    return -1;
+  }
+  if (dfa->count == dfa->cap) {
+    int cap = dfa->cap ? dfa->cap * 2 : 64;
+    NfaState *grown = realloc(dfa->states, cap * sizeof(NfaState));
+    if (grown == NULL) {
+      p->error = "out of memory";
+      return -1;
+    }
+    dfa->states = grown;
+    dfa->cap = cap;
+  }
+  NfaState *state = &dfa->states[dfa->count];
+  memset(state, 0, sizeof(NfaState));
+  state->type = type;
+  state->out = -1;
+  state->out2 = -1;
+  return dfa->count++;
+}
+
+static int *exit_field(Dfa *dfa, int code) {
+  NfaState *state = &dfa->states[code >> 1];
+  return (code & 1) ? &state->out2 : &state->out;
+}
+
+static void patch(Dfa *dfa, int list, int target) {
+  while (list != -1) {
+    int *field = exit_field(dfa, list);
+    list = *field;
+    *field = target;
+  }
+}
+
+static int append(Dfa *dfa, int list1, int list2) {
+  if (list1 == -1)
+    return list2;
+  int list = list1;
+  for (;;) {
+    int *field = exit_field(dfa, list);
+    if (*field == -1) {
+      *field = list2;
+      return list1;
+    }
+    list = *field;
+  }
+}
+
+static Frag empty_frag(Parser *p) {
+  int s = new_state(p, NFA_EMPTY);
+  return (Frag){s, s < 0 ? -1 : s * 2};
+}
+
+static Frag set_frag(Parser *p, const uint64_t *set) {
+  int s = new_state(p, NFA_SET);
+  if (s < 0)
+    return (Frag){-1, -1};
+  memcpy(p->dfa->states[s].set, set, sizeof(p->dfa->states[s].set));
+  return (Frag){s, s * 2};
+}
+
+static Frag split_frag(Parser *p, Frag f, bool loop, bool skip) {
+  int s = new_state(p, NFA_SPLIT);
+  if (s < 0)
+    return (Frag){-1, -1};
+  p->dfa->states[s].out = f.start;
+  if (loop) // star and plus: come back round after f
+    patch(p->dfa, f.out, s);
+  if (loop && !skip) // plus: enter through f, leave through the split
+    return (Frag){f.start, s * 2 + 1};
+  if (loop) // star
+    return (Frag){s, s * 2 + 1};
+  return (Frag){s, append(p->dfa, f.out, s * 2 + 1)}; // quest
+}
+
+static Frag concat(Parser *p, Frag a, Frag b, bool have_a) {
+  if (!have_a)
+    return b;
+  patch(p->dfa, a.out, b.start);
+  return (Frag){a.start, b.out};
+}
+
+static bool at_end(Parser *p) {
+  return p->pos >= p->end;
+}
+
+// Parse the character after a backslash into set
+static void parse_escape(Parser *p, uint64_t *set) {
+  if (at_end(p)) {
+    p->error = "trailing backslash";
+    return;
+  }
+  unsigned char c = (unsigned char)p->pattern[p->pos++];
+  uint64_t class[4] = {0};
+  switch (c) {
+  case 'd':
+  case 'D':
+    set_add_range(class, '0', '9');
+    break;
+  case 'w':
+  case 'W':
+    set_add_range(class, 'a', 'z');
+    set_add_range(class, 'A', 'Z');
+    set_add_range(class, '0', '9');
+    set_add(class, '_');
+    break;
+  case 's':
+  case 'S':
+    set_add(class, ' ');
+    set_add_range(class, '\t', '\r');
+    break;
+  case 'n':
+    set_add(set, '\n');
+    return;
+  case 't':
+    set_add(set, '\t');
+    return;
+  case 'r':
+    set_add(set, '\r');
+    return;
+  default:
+    set_add(set, c);
+    return;
+  }
+  if (c == 'D' || c == 'W' || c == 'S')
+    set_invert(class);
+  for (int i = 0; i < 4; i++)
+    set[i] |= class[i];
+}
+
+static Frag parse_class(Parser *p) {
+  uint64_t set[4] = {0};
+  bool negate = false;
+  if (!at_end(p) && p->pattern[p->pos] == '^') {
+    negate = true;
+    p->pos++;
+  }
+
+  bool first = true;
+  while (!at_end(p) && (p->pattern[p->pos] != ']' || first)) {
+    first = false;
+    unsigned char lo = (unsigned char)p->pattern[p->pos++];
+    if (lo == '\\') {
+      uint64_t escaped[4] = {0};
+      parse_escape(p, escaped);
+      if (p->error)
+        return (Frag){-1, -1};
+      // a single escaped character can still start a range
+      int count = 0;
+      for (int c = 0; c < 256; c++) {
+        if (set_has(escaped, (unsigned char)c)) {
+          lo = (unsigned char)c;
+          count++;
+        }
+      }
+      if (count != 1) {
+        for (int i = 0; i < 4; i++)
+          set[i] |= escaped[i];
+        continue;
+      }
+    }
+
+    if (p->pos + 1 < p->end && p->pattern[p->pos] == '-' && p->pattern[p->pos + 1] != ']') {
+      p->pos++;
+      unsigned char hi = (unsigned char)p->pattern[p->pos++];
+      if (hi == '\\') {
+        if (at_end(p)) {
+          p->error = "trailing backslash";
+          return (Frag){-1, -1};
+        }
+        hi = (unsigned char)p->pattern[p->pos++];
+      }
+      if (hi < lo) {
+        p->error = "invalid range in character class";
+        return (Frag){-1, -1};
+      }
+      set_add_range(set, lo, hi);
+    } else {
+      set_add(set, lo);
+    }
+  }
+  if (at_end(p)) {
+    p->error = "missing ']'";
+    return (Frag){-1, -1};
+  }
+  p->pos++; // ']'
+
+  if (p->icase)
+    set_fold(set);
+  if (negate)
+    set_invert(set);
+  return set_frag(p, set);
+}
+
+static Frag parse_atom(Parser *p) {
+  unsigned char c = (unsigned char)p->pattern[p->pos++];
+  uint64_t set[4] = {0};
+
+  switch (c) {
+  case '(': {
+    if (p->pos + 1 < p->end && p->pattern[p->pos] == '?' && p->pattern[p->pos + 1] == ':')
+      p->pos += 2;
+    p->depth++;
+    Frag f = parse_alt(p);
+    p->depth--;
+    if (p->error)
+      return f;
+    if (at_end(p) || p->pattern[p->pos] != ')') {
+      p->error = "missing ')'";
+      return (Frag){-1, -1};
+    }
+    p->pos++;
+    return f;
+  }
+  case '[':
+    return parse_class(p);
+  case '.':
+    set_invert(set);
+    set[0] &= ~(UINT64_C(1) << '\n');
+    return set_frag(p, set);
+  case '\\':
+    parse_escape(p, set);
+    break;
+  case '*':
+  case '+':
+  case '?':
+    p->error = "nothing to repeat";
+    return (Frag){-1, -1};
+  case '^':
+  case '$':
+    p->error = "'^' and '$' are only supported at the start and end of a pattern or of its top level alternatives";
+    return (Frag){-1, -1};
+  default:
+    set_add(set, c);
+    break;
+  }
+  if (p->error)
+    return (Frag){-1, -1};
+  if (p->icase)
+    set_fold(set);
+  return set_frag(p, set);
+}
+
+static bool parse_count(Parser *p, int *value) {
+  if (at_end(p) || p->pattern[p->pos] < '0' || p->pattern[p->pos] > '9')
+    return false;
+  *value = 0;
+  while (!at_end(p) && p->pattern[p->pos] >= '0' && p->pattern[p->pos] <= '9') {
+    *value = *value * 10 + (p->pattern[p->pos++] - '0');
+    if (*value > DFA_MAX_REPEAT) {
+      p->error = "repeat count is too large";
+      return false;
+    }
+  }
+  return true;
+}
+
+// Expand atom{min,max} (max < 0: unbounded) into copies of the atom, re-parsing
+// its source text for every copy after the first.
+static Frag repeat(Parser *p, Frag atom, size_t atom_pos, int min, int max) {
+  size_t after = p->pos;
+  bool used = false;
+  bool have = false;
+  Frag result = {-1, -1};
+  int copies = max < 0 ? min + 1 : max;
+
+  for (int i = 0; i < copies && !p->error; i++) {
+    Frag part = atom;
+    if (used) {
+      p->pos = atom_pos;
+      part = parse_atom(p);
+      if (p->error)
+        break;
+    }
+    used = true;
+    if (i >= min)
+      part = split_frag(p, part, max < 0, true);
+    result = concat(p, result, part, have);
+    have = true;
+  }
+  p->pos = after;
+  return have ? result : empty_frag(p);
+}
+
+static Frag parse_repeat(Parser *p) {
+  size_t atom_pos = p->pos;
+  Frag f = parse_atom(p);
+  bool bare = true; // f is still just the atom at atom_pos
+
+  while (!p->error && !at_end(p)) {
+    char c = p->pattern[p->pos];
+    if (c == '*' || c == '+' || c == '?') {
+      p->pos++;
+      f = split_frag(p, f, c != '?', c != '+');
+    } else if (c == '{') {
+      size_t brace = p->pos++;
+      if (!bare) {
+        p->error = "a repeated expression needs a group to be repeated again";
+        break;
+      }
+      int min, max;
+      if (!parse_count(p, &min)) {
+        if (!p->error) // not a counted repeat, '{' is taken literally by the next atom
+          p->pos = brace;
+        break;
+      }
+      max = min;
+      if (!at_end(p) && p->pattern[p->pos] == ',') {
+        p->pos++;
+        if (!parse_count(p, &max))
+          max = -1;
+      }
+      if (p->error)
+        break;
+      if (at_end(p) || p->pattern[p->pos] != '}' || (max >= 0 && max < min)) {
+        p->error = "invalid repeat count";
+        break;
+      }
+      p->pos++;
+      f = repeat(p, f, atom_pos, min, max);
+    } else {
+      break;
+    }
+    bare = false;
+  }
+  return f;
+}
+
+static Frag parse_concat(Parser *p) {
+  Frag f = {-1, -1};
+  bool have = false;
+  while (!p->error && !at_end(p) && p->pattern[p->pos] != '|' && p->pattern[p->pos] != ')') {
+    // '$' ending a top level alternative
+    if (p->depth == 0 && p->pattern[p->pos] == '$' && (p->pos + 1 == p->end || p->pattern[p->pos + 1] == '|')) {
+      p->pos++;
+      p->anchored_end = true;
+      break;
+    }
+    Frag next = parse_repeat(p);
+    if (p->error)
+      break;
+    f = concat(p, f, next, have);
+    have = true;
+  }
+  return have ? f : empty_frag(p);
+}
+
+static Frag parse_alt(Parser *p) {
+  Frag f = parse_concat(p);
+  while (!p->error && !at_end(p) && p->pattern[p->pos] == '|') {
+    p->pos++;
+    Frag next = parse_concat(p);
+    if (p->error)
+      break;
+    int s = new_state(p, NFA_SPLIT);
+    if (s < 0)
+      break;
+    p->dfa->states[s].out = f.start;
+    p->dfa->states[s].out2 = next.start;
+    f = (Frag){s, append(p->dfa, f.out, next.out)};
+  }
+  return f;
+}
+
+// Split the 256 byte values into classes that no state in the NFA tells apart
+static void build_classes(Dfa *dfa) {
+  bool boundary[257] = {false};
+  for (int i = 0; i < dfa->count; i++) {
+    if (dfa->states[i].type != NFA_SET)
+      continue;
+    for (int c = 1; c < 256; c++) {
+      if (set_has(dfa->states[i].set, (unsigned char)c) != set_has(dfa->states[i].set, (unsigned char)(c - 1)))
+        boundary[c] = true;
+    }
+  }
+  int class = 0;
+  dfa->class_rep[0] = 0;
+  for (int c = 0; c < 256; c++) {
+    if (c > 0 && boundary[c]) {
+      class++;
+      dfa->class_rep[class] = (unsigned char)c;
+    }
+    dfa->classmap[c] = (unsigned char)class;
+  }
+  dfa->class_count = class + 1;
+}
+
+Dfa *dfa_compile(const char *pattern, bool icase, char *err, size_t err_len) {
+  Dfa *dfa = NULL;
+  dfa = m_alloc(dfa, sizeof(Dfa), "regex");
+  if (dfa == NULL) {
+    snprintf(err, err_len, "out of memory");
+    return NULL;
+  }
+  memset(dfa, 0, sizeof(Dfa));
+
+  // Each top level alternative carries its own anchors, so "^a|b$" is "^a" or "b$".
+  // Those starting with '^' are only entered at the start of the text, the others at
+  // every position, and those ending with '$' lead to a match state that only counts
+  // at the end of the text.
+  Parser p = {.dfa = dfa, .pattern = pattern, .pos = 0, .end = strlen(pattern), .icase = icase};
+  dfa->start = -1;
+  dfa->floating_start = -1;
+  for (;;) {
+    bool anchored_start = !at_end(&p) && pattern[p.pos] == '^';
+    if (anchored_start)
+      p.pos++;
+    p.anchored_end = false;
+    Frag f = parse_concat(&p);
+    if (p.error)
+      break;
+    int match = new_state(&p, p.anchored_end ? NFA_MATCH_END : NFA_MATCH);
+    if (match < 0)
+      break;
+    patch(dfa, f.out, match);
+
+    int *start = anchored_start ? &dfa->start : &dfa->floating_start;
+    if (*start < 0) {
+      *start = f.start;
+    } else {
+      int s = new_state(&p, NFA_SPLIT);
+      if (s < 0)
+        break;
+      dfa->states[s].out = *start;
+      dfa->states[s].out2 = f.start;
+      *start = s;
+    }
+
+    if (at_end(&p))
+      break;
+    if (pattern[p.pos] != '|') {
+      p.error = "unmatched ')'";
+      break;
+    }
+    p.pos++;
+  }
+  if (p.error) {
+    snprintf(err, err_len, "%s at offset %zu", p.error, p.pos);
+    dfa_free(dfa);
+    return NULL;
+  }
+
+  build_classes(dfa);
+  return dfa;
+}
+
+void dfa_free(Dfa *dfa) {
+  free(dfa->states);
+  free(dfa);
+}
+
+static void cache_flush(DfaCache *cache) {
+  size_t trans_len = (size_t)DFA_CACHE_STATES * cache->dfa->class_count;
+  for (size_t i = 0; i < trans_len; i++)
+    cache->trans[i] = -1;
+  for (int i = 0; i < DFA_CACHE_STATES * 2; i++)
+    cache->hash[i] = -1;
+  cache->state_count = 0;
+  cache->members_used = 0;
+  cache->start = -1;
+  cache->flushes++;
+}
+
+DfaCache *dfa_cache_new(const Dfa *dfa) {
+  DfaCache *cache = NULL;
+  cache = m_alloc(cache, sizeof(DfaCache), "regex cache");
+  if (cache == NULL)
+    return NULL;
+  cache->dfa = dfa;
+  // the transition table is the hot part of a search, keep it on as few TLB entries as possible
+  cache->trans = huge_alloc((size_t)DFA_CACHE_STATES * dfa->class_count * sizeof(int), "regex cache");
+  cache->member_start = NULL;
+  cache->member_start = m_alloc(cache->member_start, DFA_CACHE_STATES * sizeof(int), "regex cache");
+  cache->member_count = NULL;
+  cache->member_count = m_alloc(cache->member_count, DFA_CACHE_STATES * sizeof(int), "regex cache");
+  cache->accept = NULL;
+  cache->accept = m_alloc(cache->accept, DFA_CACHE_STATES * sizeof(bool), "regex cache");
+  cache->accept_end = NULL;
+  cache->accept_end = m_alloc(cache->accept_end, DFA_CACHE_STATES * sizeof(bool), "regex cache");
+  cache->members_cap = (size_t)dfa->count * 4 > 65536 ? (size_t)dfa->count * 4 : 65536;
+  cache->members = NULL;
+  cache->members = m_alloc(cache->members, cache->members_cap * sizeof(int), "regex cache");
+  cache->hash = NULL;
+  cache->hash = m_alloc(cache->hash, DFA_CACHE_STATES * 2 * sizeof(int), "regex cache");
+  cache->scratch = NULL;
+  cache->scratch = m_alloc(cache->scratch, dfa->count * sizeof(int), "regex cache");
+  cache->stack = NULL;
+  cache->stack = m_alloc(cache->stack, (dfa->count * 3 + 2) * sizeof(int), "regex cache");
+  cache->mark = NULL;
+  cache->mark = m_alloc(cache->mark, dfa->count * sizeof(unsigned), "regex cache");
+  if (cache->trans == NULL || cache->member_start == NULL || cache->member_count == NULL || cache->accept == NULL ||
+      cache->accept_end == NULL || cache->members == NULL || cache->hash == NULL || cache->scratch == NULL || cache->stack == NULL ||
+      cache->mark == NULL) {
+    dfa_cache_free(cache);
+    return NULL;
+  }
+  memset(cache->mark, 0, dfa->count * sizeof(unsigned));
+  cache->generation = 0;
+  cache->flushes = 0;
+  cache_flush(cache);
+  return cache;
+}
+
+void dfa_cache_free(DfaCache *cache) {
+  huge_free(cache->trans, (size_t)DFA_CACHE_STATES * cache->dfa->class_count * sizeof(int));
+  free(cache->member_start);
+  free(cache->member_count);
+  free(cache->accept);
+  free(cache->accept_end);
+  free(cache->members);
+  free(cache->hash);
+  free(cache->scratch);
+  free(cache->stack);
+  free(cache->mark);
+  free(cache);
+}
+
+// Add the SET and MATCH states reachable from state without consuming input
+static void add_closure(DfaCache *cache, int state) {
+  const NfaState *states = cache->dfa->states;
+  int top = 0;
+  cache->stack[top++] = state;
+  while (top > 0) {
+    int s = cache->stack[--top];
+    if (s < 0 || cache->mark[s] == cache->generation)
+      continue;
+    cache->mark[s] = cache->generation;
+    switch (states[s].type) {
+    case NFA_SET:
+    case NFA_MATCH:
+    case NFA_MATCH_END:
+      cache->scratch[cache->scratch_len++] = s;
+      break;
+    case NFA_SPLIT:
+      cache->stack[top++] = states[s].out2;
+      cache->stack[top++] = states[s].out;
+      break;
+    case NFA_EMPTY:
+      cache->stack[top++] = states[s].out;
+      break;
+    }
+  }
+}
+
+static void begin_set(DfaCache *cache) {
+  cache->scratch_len = 0;
+  if (++cache->generation == 0) { // wrapped, old marks could look current
+    memset(cache->mark, 0, cache->dfa->count * sizeof(unsigned));
+    cache->generation = 1;
+  }
+}
+
+static int compare_int(const void *a, const void *b) {
+  return (*(const int *)a > *(const int *)b) - (*(const int *)a < *(const int *)b);
+}
+
+// Find or add the DFA state for the NFA states in scratch. Flushes the cache when full.
+static int intern_set(DfaCache *cache) {
+  int n = cache->scratch_len;
+  qsort(cache->scratch, n, sizeof(int), compare_int);
+
+  uint32_t h = 2166136261u;
+  for (int i = 0; i < n; i++)
+    h = (h ^ (uint32_t)cache->scratch[i]) * 16777619u;
+
+  int slots = DFA_CACHE_STATES * 2;
+  int slot = h % slots;
+  for (; cache->hash[slot] != -1; slot = (slot + 1) % slots) {
+    int s = cache->hash[slot];
+    if (cache->member_count[s] == n &&
+        memcmp(cache->members + cache->member_start[s], cache->scratch, n * sizeof(int)) == 0)
+      return s;
+  }
+
+  if (cache->state_count == DFA_CACHE_STATES || cache->members_used + n > cache->members_cap) {
+    cache_flush(cache);
+    for (slot = h % slots; cache->hash[slot] != -1; slot = (slot + 1) % slots)
+      ;
+  }
+
+  int s = cache->state_count++;
+  cache->member_start[s] = (int)cache->members_used;
+  cache->member_count[s] = n;
+  memcpy(cache->members + cache->members_used, cache->scratch, n * sizeof(int));
+  cache->members_used += n;
+  cache->accept[s] = false;
+  cache->accept_end[s] = false;
+  for (int i = 0; i < n; i++) {
+    int type = cache->dfa->states[cache->scratch[i]].type;
+    if (type == NFA_MATCH)
+      cache->accept[s] = true;
+    else if (type == NFA_MATCH_END)
+      cache->accept_end[s] = true;
+  }
+  cache->hash[slot] = s;
+  return s;
+}
+
+static int start_state(DfaCache *cache) {
+  if (cache->start < 0) {
+    begin_set(cache);
+    if (cache->dfa->start >= 0)
+      add_closure(cache, cache->dfa->start);
+    if (cache->dfa->floating_start >= 0)
+      add_closure(cache, cache->dfa->floating_start);
+    cache->start = intern_set(cache);
+  }
+  return cache->start;
+}
+
+static int next_state(DfaCache *cache, int state, int class) {
+  const Dfa *dfa = cache->dfa;
+  unsigned char byte = dfa->class_rep[class];
+
+  begin_set(cache);
+  const int *members = cache->members + cache->member_start[state];
+  for (int i = 0; i < cache->member_count[state]; i++) {
+    const NfaState *s = &dfa->states[members[i]];
+    if (s->type == NFA_SET && set_has(s->set, byte))
+      add_closure(cache, s->out);
+  }
+  if (dfa->floating_start >= 0) // these may begin at any position
+    add_closure(cache, dfa->floating_start);
+
+  unsigned flushes = cache->flushes;
+  int next = intern_set(cache);
+  if (flushes == cache->flushes) // state is gone if the cache was flushed
+    cache->trans[state * dfa->class_count + class] = next;
+  return next;
+}
+
+bool dfa_search(DfaCache *cache, const char *text, size_t len) {
+  const Dfa *dfa = cache->dfa;
+  int state = start_state(cache);
+
+  for (size_t i = 0; i < len; i++) {
+    if (cache->accept[state])
+      return true;
+    if (cache->member_count[state] == 0) // dead, nothing can match any more
+      return false;
+    int class = dfa->classmap[(unsigned char)text[i]];
+    int next = cache->trans[state * dfa->class_count + class];
+    state = next >= 0 ? next : next_state(cache, state, class);
+  }
+  return cache->accept[state] || cache->accept_end[state];
+}
@@ -0,0 +1,29 @@
+#ifndef DFA_H
+#define DFA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A regular expression compiled to an NFA, run as a lazily built DFA. There is no
+// backtracking, so a search is linear in the length of the text.
+//
+// Supported syntax: literals, '.', [classes] with ranges and '^' negation, \d \w \s
+// (and \D \W \S), '*', '+', '?', {m}, {m,}, {m,n}, '|', (groups) and (?:groups).
+// '^' and '$' are only allowed at the start and end of the pattern or of its top
+// level alternatives, which they anchor one by one: "^a|b$" is "^a" or "b$".
+typedef struct Dfa Dfa;
+
+// The lazily built DFA states for one compiled pattern. A cache is not thread safe,
+// so each thread searching with a Dfa needs its own.
+typedef struct DfaCache DfaCache;
+
+Dfa *dfa_compile(const char *pattern, bool icase, char *err, size_t err_len);
+void dfa_free(Dfa *dfa);
+
+// NULL when memory runs out
+DfaCache *dfa_cache_new(const Dfa *dfa);
+void dfa_cache_free(DfaCache *cache);
+
+bool dfa_search(DfaCache *cache, const char *text, size_t len);
+
+#endif
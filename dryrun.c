@@ -0,0 +1,168 @@
+#define _GNU_SOURCE
+#include "dryrun.h"
+#include "match.h"
+#include "reader.h"
+#include "util.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+  size_t kept_entries;
+  size_t kept_bytes;
+  size_t *removed_entries; // per identifier
+  size_t *removed_bytes;
+} DryRunCounts;
+
+static void count_record(const Record *record, const Config *config, MatchState *state, DryRunCounts *counts) {
+  if (record->content_len == 0 || is_padding(record->data, record->content_len)) // ignored, as when cleaning
+    return;
+  int k = matching_identifier(record->data, record->content_len, config, state);
+  if (k >= 0) {
+    counts->removed_entries[k]++;
+    counts->removed_bytes[k] += record->len;
+  } else {
+    counts->kept_entries++;
+    counts->kept_bytes += record->len;
+  }
+}
+
+// Count the records that start in [start, end). The record the block starts
+// part way through was counted with the block before, so it is skipped.
+static void scan_block(Reader *reader, off_t start, off_t end, const Config *config, MatchState *state,
+                       DryRunCounts *counts) {
+  Record record;
+  if (start > 0) {
+    // step back one byte so a record starting exactly at start is not skipped
+    reader_seek(reader, start - 1);
+    if (!reader_next_record(reader, NULL, 0, &record))
+      return;
+    // in record mode, continuation lines up to the next record start are skipped too
+    if (config->record_start && reader_offset(reader) < end) {
+      if (!reader_next_record(reader, config->record_start, config->record_start_len, &record))
+        return;
+      if (record.len >= config->record_start_len &&
+          memcmp(record.data, config->record_start, config->record_start_len) == 0)
+        count_record(&record, config, state, counts);
+    }
+  } else {
+    reader_seek(reader, 0);
+  }
+
+  while (reader_offset(reader) < end &&
+         reader_next_record(reader, config->record_start, config->record_start_len, &record))
+    count_record(&record, config, state, counts);
+}
+
+static void print_size(const char *label, double entries, double bytes) {
+  printf("%s %.0f entries, %.1f MB\n", label, entries, bytes / (1024 * 1024));
+}
+
+// Report what cleaning the file would keep and remove, per identifier, without
+// writing anything. With sample_percent < 100, only that share of the file is read,
+// in randomly picked blocks, and the counts are scaled up to the whole file.
+bool dry_run_file(const char *file_path, const Config *config, double sample_percent, char *err, size_t err_len) {
+  Reader *reader = reader_open(file_path, config->line_separator);
+  if (reader == NULL) {
+    snprintf(err, err_len, "Error opening %s: %s", file_path, strerror(errno));
+    return false;
+  }
+  struct stat st;
+  if (fstat(reader->fd, &st) != 0) {
+    snprintf(err, err_len, "Error opening %s: %s", file_path, strerror(errno));
+    reader_close(reader);
+    return false;
+  }
+
+  MatchState *state = match_state_new(config);
+  DryRunCounts counts = {0};
+  counts.removed_entries = NULL;
+  counts.removed_entries = m_alloc(counts.removed_entries, config->identifier_count * sizeof(size_t), "dry run counts");
+  counts.removed_bytes = NULL;
+  counts.removed_bytes = m_alloc(counts.removed_bytes, config->identifier_count * sizeof(size_t), "dry run counts");
+  if (state == NULL || counts.removed_entries == NULL || counts.removed_bytes == NULL) {
+    snprintf(err, err_len, "Out of memory for the dry run of %s", file_path);
+    free(counts.removed_entries);
+    free(counts.removed_bytes);
+    if (state != NULL)
+      match_state_free(state);
+    reader_close(reader);
+    return false;
+  }
+  memset(counts.removed_entries, 0, config->identifier_count * sizeof(size_t));
+  memset(counts.removed_bytes, 0, config->identifier_count * sizeof(size_t));
+
+  off_t size = st.st_size;
+  off_t blocks = (size + DRY_RUN_BLOCK_SIZE - 1) / DRY_RUN_BLOCK_SIZE;
+  off_t scanned = 0;
+  off_t scanned_blocks = 0;
+  if (sample_percent >= 100 || blocks <= 1) {
+    scan_block(reader, 0, size, config, state, &counts);
+    scanned = size;
+    scanned_blocks = blocks;
+  } else {
+    reader->read_size = DRY_RUN_READ_SIZE;
+    unsigned seed = (unsigned)time(NULL) ^ (unsigned)getpid();
+    for (off_t b = 0; b < blocks; b++) {
+      // always take at least one block
+      bool last_chance = b == blocks - 1 && scanned_blocks == 0;
+      if (!last_chance && rand_r(&seed) / ((double)RAND_MAX + 1) * 100 >= sample_percent)
+        continue;
+      off_t start = b * DRY_RUN_BLOCK_SIZE;
+      off_t end = start + DRY_RUN_BLOCK_SIZE < size ? start + DRY_RUN_BLOCK_SIZE : size;
+      scan_block(reader, start, end, config, state, &counts);
+      scanned += end - start;
+      scanned_blocks++;
+    }
+  }
+
+  if (reader->error) {
+    snprintf(err, err_len, "Error reading %s: %s", file_path, strerror(reader->error));
+    free(counts.removed_entries);
+    free(counts.removed_bytes);
+    match_state_free(state);
+    reader_close(reader);
+    return false;
+  }
+
+  double scale = scanned > 0 ? (double)size / scanned : 0;
+  double removed_entries = 0;
+  double removed_bytes = 0;
+  for (int k = 0; k < config->identifier_count; k++) {
+    removed_entries += counts.removed_entries[k];
+    removed_bytes += counts.removed_bytes[k];
+  }
+
+  if (scanned == size)
+    printf("Dry run of %s, whole file scanned\n", file_path);
+  else
+    printf("Dry run of %s, %lld of %lld blocks (%.1f%%) sampled, estimates:\n", file_path, (long long)scanned_blocks,
+           (long long)blocks, 100.0 * scanned / size);
+  print_size("Kept:   ", counts.kept_entries * scale, counts.kept_bytes * scale);
+  print_size("Removed:", removed_entries * scale, removed_bytes * scale);
+  for (int k = 0; k < config->identifier_count; k++) {
+    char label[128];
+    char number[16];
+    const char *name = config->identifiers[k]->name;
+    if (name == NULL) {
+      snprintf(number, sizeof(number), "%d", k + 1);
+      name = number;
+    }
+    int bucket = config->identifiers[k]->bucket;
+    if (bucket >= 0)
+      snprintf(label, sizeof(label), "  identifier %s (%s):", name, config->buckets[bucket]);
+    else
+      snprintf(label, sizeof(label), "  identifier %s:", name);
+    print_size(label, counts.removed_entries[k] * scale, counts.removed_bytes[k] * scale);
+  }
+
+  free(counts.removed_entries);
+  free(counts.removed_bytes);
+  match_state_free(state);
+  reader_close(reader);
+  return true;
+}
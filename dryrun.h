@@ -0,0 +1,17 @@
+#ifndef DRYRUN_H
+#define DRYRUN_H
+
+#include "config.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// size of the blocks picked at random when a dry run samples the file
+#define DRY_RUN_BLOCK_SIZE (1024 * 1024)
+// a sampled block is read in pieces of this size, so only what it holds and the
+// record straddling its end are read, rather than a whole reader buffer
+#define DRY_RUN_READ_SIZE (64 * 1024)
+
+// false with err set when the file cannot be read
+bool dry_run_file(const char *file_path, const Config *config, double sample_percent, char *err, size_t err_len);
+
+#endif
@@ -0,0 +1,848 @@
+// Differential test of the cleaning engine against a naive reference.
+//
+// Each case turns its input bytes into a config (text, field, key, anchor, icase,
+// not and regex items, buckets, record_start and separators) and a log over a small
+// alphabet, or of JSON entries, cleans the log with clean_file() and checks the
+// cleaned, removed and bucket files byte for byte against what the reference
+// expects. A case cleans the normal way, or in place with --live or --sparse; the
+// log is repeated then, so runs can span whole blocks, and the cleaned file is
+// compared without its blank and padding lines, which in place cleaning leaves where
+// compaction drops them. The same log is also run through lc_filter(), outside live
+// mode, whose records and identifiers must route the same way, as the library shares
+// the record splitter and matcher. The reference splits, groups and matches records
+// the plain way: a byte by byte substring search, fields found by walking the entry,
+// and POSIX regexec() for regex items. Key items are looked up by parsing each entry
+// as JSON, checking every value on the way.
+//
+// Built two ways:
+//   make fuzz             standalone driver over random inputs: ./log-cleaner-fuzz [iterations] [seed]
+//   make fuzz-libfuzzer   LLVMFuzzerTestOneInput for clang's libFuzzer: ./log-cleaner-libfuzzer
+// On a mismatch the case is saved as fuzz-failure.json and fuzz-failure.log and the run aborts.
+#define _GNU_SOURCE
+#include "cJSON.h"
+#include "clean.h"
+#include "config.h"
+#include "logcleaner.h"
+#include "record.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <regex.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FUZZ_MAX_IDENTIFIERS 4
+#define FUZZ_MAX_ITEMS 4
+#define FUZZ_BUCKETS 2
+#define FUZZ_IN_PLACE_REPEAT 8
+
+typedef enum { MODE_COMPACT, MODE_LIVE, MODE_SPARSE, MODE_COUNT } Mode;
+
+static const char log_alphabet[] = "abAB[ \t,;\r\n";
+static const char text_alphabet[] = "abAB[ ,\t";
+// JSON entries are built from these pieces; values hold escaped quotes and backslashes
+static const char *json_names[] = {"a", "b", "ab", "a\\\"b"};
+static const char *json_chars[] = {"a", "b", "A", " ", "1", "\\\"", "\\\\"};
+static const char *json_spaces[] = {"", "", " ", "\t "};
+static const char *key_paths[] = {"a", "b", "ab", "a.b", "ab.a", "b.a.b"};
+static const char json_text_alphabet[] = "abA 1\\\"";
+
+// The input bytes, consumed front to back. Once used up every byte reads as 0.
+typedef struct {
+  const uint8_t *data;
+  size_t size;
+  size_t pos;
+} Bytes;
+
+static unsigned pick(Bytes *bytes, unsigned n) {
+  if (bytes->pos >= bytes->size)
+    return 0;
+  return bytes->data[bytes->pos++] % n;
+}
+
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+} Buffer;
+
+static void buffer_append(Buffer *buffer, const char *data, size_t len) {
+  if (buffer->len + len + 1 > buffer->cap) {
+    buffer->cap = (buffer->len + len + 1) * 2;
+    buffer->data = realloc(buffer->data, buffer->cap);
+    if (buffer->data == NULL) {
+      printf("Unable to allocate memory for %s\n", "fuzz buffer");
+      exit(EXIT_FAILURE);
+    }
+  }
+  memcpy(buffer->data + buffer->len, data, len);
+  buffer->len += len;
+  buffer->data[buffer->len] = '\0';
+}
+
+// The reference's view of an item, kept next to the JSON it is written as
+typedef struct {
+  char text[64];
+  bool regex;
+  int field;
+  const char *key; // JSON key path, or NULL
+  Anchor anchor;
+  bool icase;
+  bool negate;
+  regex_t compiled;
+} RefItem;
+
+typedef struct {
+  RefItem items[FUZZ_MAX_ITEMS];
+  int length;
+  int bucket; // -1 for the shared removed file
+} RefIdentifier;
+
+typedef struct {
+  RefIdentifier identifiers[FUZZ_MAX_IDENTIFIERS];
+  int identifier_count;
+  const char *record_start;
+  char field_separator;
+  char line_separator;
+  bool json; // the log holds JSON entries, and items may be key items
+} RefConfig;
+
+// ---- generating a case ----
+
+static void random_text(Bytes *bytes, char *text, const char *alphabet) {
+  int len = 1 + pick(bytes, 3);
+  for (int i = 0; i < len; i++)
+    text[i] = alphabet[pick(bytes, strlen(alphabet))];
+  text[len] = '\0';
+}
+
+// A small pattern that means the same to the engine's regexes and POSIX EREs. It may
+// have two top level alternatives, each with its own anchors.
+static void random_regex(Bytes *bytes, char *pattern) {
+  static const char *atoms[] = {"a", "b", "A", " ", ".", "[ab]", "[^a]", "(a|b)", "(ab|B)"};
+  static const char *quantifiers[] = {"", "", "*", "+", "?", "{1,2}"};
+  pattern[0] = '\0';
+  int alternatives = 1 + (pick(bytes, 3) == 0);
+  for (int j = 0; j < alternatives; j++) {
+    if (j > 0)
+      strcat(pattern, "|");
+    if (pick(bytes, 4) == 0)
+      strcat(pattern, "^");
+    int atom_count = 1 + pick(bytes, 2);
+    for (int i = 0; i < atom_count; i++) {
+      strcat(pattern, atoms[pick(bytes, sizeof(atoms) / sizeof(atoms[0]))]);
+      strcat(pattern, quantifiers[pick(bytes, sizeof(quantifiers) / sizeof(quantifiers[0]))]);
+    }
+    if (pick(bytes, 4) == 0)
+      strcat(pattern, "$");
+  }
+}
+
+static cJSON *generate_item(Bytes *bytes, RefItem *item, bool regex_allowed, bool json) {
+  memset(item, 0, sizeof(RefItem));
+  if (json && pick(bytes, 3) != 0)
+    item->key = key_paths[pick(bytes, sizeof(key_paths) / sizeof(key_paths[0]))];
+  item->regex = regex_allowed && pick(bytes, 3) == 0;
+  if (item->regex)
+    random_regex(bytes, item->text);
+  else
+    random_text(bytes, item->text, item->key ? json_text_alphabet : text_alphabet);
+  item->field = item->key == NULL && pick(bytes, 3) == 0 ? 1 + pick(bytes, 3) : 0;
+  item->anchor = item->regex ? ANCHOR_NONE : (Anchor)pick(bytes, 4);
+  item->icase = pick(bytes, 3) == 0;
+  item->negate = pick(bytes, 4) == 0;
+
+  if (!item->regex && item->field == 0 && item->key == NULL && item->anchor == ANCHOR_NONE && !item->icase &&
+      !item->negate)
+    return cJSON_CreateString(item->text);
+
+  static const char *anchors[] = {NULL, "prefix", "suffix", "exact"};
+  cJSON *object = cJSON_CreateObject();
+  cJSON_AddStringToObject(object, item->regex ? "regex" : "text", item->text);
+  if (item->field)
+    cJSON_AddNumberToObject(object, "field", item->field);
+  if (item->key)
+    cJSON_AddStringToObject(object, "key", item->key);
+  if (item->anchor != ANCHOR_NONE)
+    cJSON_AddStringToObject(object, "anchor", anchors[item->anchor]);
+  if (item->icase)
+    cJSON_AddTrueToObject(object, "icase");
+  if (item->negate)
+    cJSON_AddTrueToObject(object, "not");
+  return object;
+}
+
+static void json_space(Bytes *bytes, Buffer *out) {
+  const char *space = json_spaces[pick(bytes, sizeof(json_spaces) / sizeof(json_spaces[0]))];
+  buffer_append(out, space, strlen(space));
+}
+
+static void json_string(Bytes *bytes, Buffer *out) {
+  buffer_append(out, "\"", 1);
+  for (unsigned i = pick(bytes, 4); i > 0; i--) {
+    const char *piece = json_chars[pick(bytes, sizeof(json_chars) / sizeof(json_chars[0]))];
+    buffer_append(out, piece, strlen(piece));
+  }
+  buffer_append(out, "\"", 1);
+}
+
+static void json_name(Bytes *bytes, Buffer *out) {
+  const char *name = json_names[pick(bytes, sizeof(json_names) / sizeof(json_names[0]))];
+  buffer_append(out, "\"", 1);
+  buffer_append(out, name, strlen(name));
+  buffer_append(out, "\"", 1);
+}
+
+static void json_value(Bytes *bytes, Buffer *out, int depth);
+
+// An object, or an array when not object, of up to three members
+static void json_container(Bytes *bytes, Buffer *out, int depth, bool object) {
+  buffer_append(out, object ? "{" : "[", 1);
+  json_space(bytes, out);
+  for (unsigned i = 0, count = pick(bytes, 4); i < count; i++) {
+    if (i > 0) {
+      buffer_append(out, ",", 1);
+      json_space(bytes, out);
+    }
+    if (object) {
+      json_name(bytes, out);
+      json_space(bytes, out);
+      buffer_append(out, ":", 1);
+      json_space(bytes, out);
+    }
+    json_value(bytes, out, depth + 1);
+    json_space(bytes, out);
+  }
+  buffer_append(out, object ? "}" : "]", 1);
+}
+
+// A well formed JSON value, nested up to depth 3
+static void json_value(Bytes *bytes, Buffer *out, int depth) {
+  static const char *scalars[] = {"1", "12", "-3.5", "true", "false", "null"};
+  unsigned kind = pick(bytes, depth < 3 ? 5 : 3);
+  if (kind == 0) {
+    json_string(bytes, out);
+  } else if (kind == 1) {
+    const char *scalar = scalars[pick(bytes, sizeof(scalars) / sizeof(scalars[0]))];
+    buffer_append(out, scalar, strlen(scalar));
+  } else if (kind == 2) {
+    json_name(bytes, out);
+  } else {
+    json_container(bytes, out, depth, kind == 3);
+  }
+}
+
+// A log of JSON entries from the rest of the input: mostly objects, some other
+// values and plain text, with the odd blank line and CRLF ending
+static void generate_json_log(Bytes *bytes, const RefConfig *config, Buffer *log) {
+  while (bytes->pos < bytes->size) {
+    unsigned kind = pick(bytes, 8);
+    json_space(bytes, log);
+    if (kind < 5)
+      json_container(bytes, log, 0, true);
+    else if (kind == 5)
+      json_value(bytes, log, 1);
+    else if (kind == 6)
+      buffer_append(log, "ab [a", 1 + pick(bytes, 5));
+    if (config->line_separator == '\n' && pick(bytes, 4) == 0)
+      buffer_append(log, "\r", 1);
+    buffer_append(log, &config->line_separator, 1);
+  }
+}
+
+// Build the config from the front of the input and write it, as config_path
+static void generate_config(Bytes *bytes, RefConfig *config, const char *config_path) {
+  static const char *record_starts[] = {NULL, NULL, "[", "a["};
+  config->record_start = record_starts[pick(bytes, 4)];
+  config->field_separator = pick(bytes, 2) ? '\t' : ',';
+  config->line_separator = pick(bytes, 4) ? '\n' : ';';
+  config->json = pick(bytes, 3) == 0;
+  // regexes only where entries hold no '\n', as '.' and [^..] treat it differently in POSIX
+  bool regex_allowed = config->record_start == NULL && config->line_separator == '\n';
+
+  cJSON *section = cJSON_CreateObject();
+  if (config->record_start)
+    cJSON_AddStringToObject(section, "record_start", config->record_start);
+  if (config->field_separator != '\t')
+    cJSON_AddStringToObject(section, "field_separator", ",");
+  if (config->line_separator != '\n')
+    cJSON_AddStringToObject(section, "line_separator", ";");
+
+  cJSON *identifiers = cJSON_AddArrayToObject(section, "identifiers");
+  config->identifier_count = 1 + pick(bytes, FUZZ_MAX_IDENTIFIERS);
+  for (int i = 0; i < config->identifier_count; i++) {
+    RefIdentifier *identifier = &config->identifiers[i];
+    identifier->length = 1 + pick(bytes, FUZZ_MAX_ITEMS);
+    identifier->bucket = (int)pick(bytes, FUZZ_BUCKETS + 2) - 2;
+    if (identifier->bucket < 0)
+      identifier->bucket = -1;
+
+    cJSON *items = cJSON_CreateArray();
+    for (int j = 0; j < identifier->length; j++)
+      cJSON_AddItemToArray(items, generate_item(bytes, &identifier->items[j], regex_allowed, config->json));
+
+    if (identifier->bucket < 0) {
+      cJSON_AddItemToArray(identifiers, items);
+    } else {
+      cJSON *object = cJSON_CreateObject();
+      cJSON_AddItemToObject(object, "items", items);
+      cJSON_AddStringToObject(object, "bucket", identifier->bucket == 0 ? "b1" : "b2");
+      cJSON_AddItemToArray(identifiers, object);
+    }
+  }
+
+  cJSON *root = cJSON_CreateObject();
+  cJSON *files = cJSON_AddObjectToObject(root, "files");
+  cJSON_AddItemToObject(files, "f.log", section);
+  char *json = cJSON_PrintUnformatted(root);
+  FILE *fp = fopen(config_path, "w");
+  if (!fp || fputs(json, fp) == EOF || fclose(fp) != 0) {
+    printf("Unable to write %s\n", config_path);
+    exit(EXIT_FAILURE);
+  }
+  free(json);
+  cJSON_Delete(root);
+
+  for (int i = 0; i < config->identifier_count; i++) {
+    for (int j = 0; j < config->identifiers[i].length; j++) {
+      RefItem *item = &config->identifiers[i].items[j];
+      if (item->regex &&
+          regcomp(&item->compiled, item->text, REG_EXTENDED | REG_NOSUB | (item->icase ? REG_ICASE : 0)) != 0) {
+        printf("Reference cannot compile regex '%s'\n", item->text);
+        abort();
+      }
+    }
+  }
+}
+
+static void free_ref_config(RefConfig *config) {
+  for (int i = 0; i < config->identifier_count; i++) {
+    for (int j = 0; j < config->identifiers[i].length; j++) {
+      if (config->identifiers[i].items[j].regex)
+        regfree(&config->identifiers[i].items[j].compiled);
+    }
+  }
+}
+
+// ---- the reference ----
+
+static char fold(char c) {
+  return (c >= 'A' && c <= 'Z') ? c | 0x20 : c;
+}
+
+static bool same(const char *a, const char *b, size_t n, bool icase) {
+  for (size_t i = 0; i < n; i++) {
+    if (icase ? fold(a[i]) != fold(b[i]) : a[i] != b[i])
+      return false;
+  }
+  return true;
+}
+
+static const char *ref_space(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+    p++;
+  return p;
+}
+
+// Past the string at p, taking its escapes one at a time, NULL when it is not one
+static const char *ref_string_end(const char *p, const char *end) {
+  for (p++; p < end; p++) {
+    if (*p == '\\') {
+      if (++p == end)
+        return NULL;
+    } else if (*p == '"') {
+      return p + 1;
+    }
+  }
+  return NULL;
+}
+
+// Past the JSON value at p, NULL when it is not a well formed one
+static const char *ref_value_end(const char *p, const char *end) {
+  if (p == end)
+    return NULL;
+  if (*p == '"')
+    return ref_string_end(p, end);
+  if (*p == '{' || *p == '[') {
+    char close = *p == '{' ? '}' : ']';
+    p = ref_space(p + 1, end);
+    if (p < end && *p == close)
+      return p + 1;
+    for (;;) {
+      if (close == '}') {
+        if (p == end || *p != '"' || (p = ref_string_end(p, end)) == NULL)
+          return NULL;
+        p = ref_space(p, end);
+        if (p == end || *p != ':')
+          return NULL;
+        p = ref_space(p + 1, end);
+      }
+      if ((p = ref_value_end(p, end)) == NULL)
+        return NULL;
+      p = ref_space(p, end);
+      if (p == end || (*p != ',' && *p != close))
+        return NULL;
+      if (*p == close)
+        return p + 1;
+      p = ref_space(p + 1, end);
+    }
+  }
+  const char *start = p;
+  while (p < end && (isalnum((unsigned char)*p) || *p == '-' || *p == '.'))
+    p++;
+  return p > start ? p : NULL;
+}
+
+// Narrow text/len down to the value at a dot separated key path, by parsing the
+// objects along it member by member. A string loses its quotes, not its escapes.
+static bool ref_json_key(const char **text, size_t *len, const char *path) {
+  const char *p = *text;
+  const char *end = p + *len;
+  for (;;) {
+    size_t key_len = strcspn(path, ".");
+    p = ref_space(p, end);
+    if (p == end || *p != '{')
+      return false;
+    p = ref_space(p + 1, end);
+    const char *value = NULL;
+    const char *value_end = NULL;
+    while (value == NULL) {
+      const char *name_end = p < end && *p == '"' ? ref_string_end(p, end) : NULL;
+      if (name_end == NULL)
+        return false;
+      bool found = (size_t)(name_end - p - 2) == key_len && memcmp(p + 1, path, key_len) == 0;
+      p = ref_space(name_end, end);
+      if (p == end || *p != ':')
+        return false;
+      p = ref_space(p + 1, end);
+      if ((value_end = ref_value_end(p, end)) == NULL)
+        return false;
+      if (found) {
+        value = p;
+      } else {
+        p = ref_space(value_end, end);
+        if (p == end || *p != ',')
+          return false;
+        p = ref_space(p + 1, end);
+      }
+    }
+    if (path[key_len] == '\0') {
+      if (*value == '"') {
+        value++;
+        value_end--;
+      }
+      *text = value;
+      *len = value_end - value;
+      return true;
+    }
+    p = value;
+    end = value_end;
+    path += key_len + 1;
+  }
+}
+
+static bool ref_item_matches(const RefItem *item, const RefConfig *config, const char *entry, size_t len) {
+  const char *text = entry;
+  if (item->field > 0) {
+    int field = 1;
+    size_t start = 0;
+    for (size_t i = 0; i < len && field < item->field; i++) {
+      if (entry[i] == config->field_separator) {
+        field++;
+        start = i + 1;
+      }
+    }
+    if (field < item->field)
+      return false;
+    size_t end = start;
+    while (end < len && entry[end] != config->field_separator)
+      end++;
+    text = entry + start;
+    len = end - start;
+  }
+  if (item->key && !ref_json_key(&text, &len, item->key))
+    return false;
+
+  if (item->regex) {
+    char *copy = strndup(text, len);
+    bool found = regexec(&item->compiled, copy, 0, NULL, 0) == 0;
+    free(copy);
+    return found;
+  }
+
+  size_t n = strlen(item->text);
+  if (n > len)
+    return false;
+  switch (item->anchor) {
+  case ANCHOR_PREFIX:
+    return same(text, item->text, n, item->icase);
+  case ANCHOR_SUFFIX:
+    return same(text + len - n, item->text, n, item->icase);
+  case ANCHOR_EXACT:
+    return len == n && same(text, item->text, n, item->icase);
+  case ANCHOR_NONE:
+  default:
+    for (size_t i = 0; i + n <= len; i++) {
+      if (same(text + i, item->text, n, item->icase))
+        return true;
+    }
+    return false;
+  }
+}
+
+// Index of the first identifier whose items all hold, or -1
+static int ref_matching_identifier(const RefConfig *config, const char *entry, size_t len) {
+  for (int i = 0; i < config->identifier_count; i++) {
+    bool all = true;
+    for (int j = 0; j < config->identifiers[i].length && all; j++) {
+      const RefItem *item = &config->identifiers[i].items[j];
+      all = ref_item_matches(item, config, entry, len) != item->negate;
+    }
+    if (all)
+      return i;
+  }
+  return -1;
+}
+
+// The end of the line at pos
+static size_t ref_line_end(const RefConfig *config, const char *log, size_t size, size_t pos) {
+  while (pos < size && log[pos] != config->line_separator)
+    pos++;
+  return pos < size ? pos + 1 : pos;
+}
+
+// The content of the line or record [pos, end), less its line ending
+static size_t ref_content(const RefConfig *config, const char *log, size_t pos, size_t end) {
+  size_t content = end - pos;
+  if (content > 0 && log[end - 1] == config->line_separator) {
+    content--;
+    if (config->line_separator == '\n' && content > 0 && log[end - 2] == '\r')
+      content--;
+  }
+  return content;
+}
+
+// The end of the record at pos: one line, then with record_start the lines up to the
+// next that starts a record. A padding line stands alone.
+static size_t ref_record_end(const RefConfig *config, const char *log, size_t size, size_t pos) {
+  size_t end = ref_line_end(config, log, size, pos);
+  if (config->record_start == NULL || is_padding(log + pos, ref_content(config, log, pos, end)))
+    return end;
+  size_t marker = strlen(config->record_start);
+  while (end < size) {
+    size_t next = ref_line_end(config, log, size, end);
+    if (next - end >= marker && memcmp(log + end, config->record_start, marker) == 0)
+      break;
+    if (log[next - 1] == config->line_separator && is_padding(log + end, ref_content(config, log, end, next)))
+      break;
+    end = next;
+  }
+  return end;
+}
+
+// Split the log into records and route each to the expected outputs. In live mode a
+// last record without a line ending may still be being written, and with record_start
+// the last record may still get continuation lines, so it stays as it is.
+static void reference_clean(const RefConfig *config, const char *log, size_t size, bool live, Buffer *cleaned,
+                            Buffer *removed, Buffer *buckets) {
+  size_t pos = 0;
+  while (pos < size) {
+    size_t end = ref_record_end(config, log, size, pos);
+
+    if (live && (log[end - 1] != config->line_separator || (config->record_start != NULL && end == size))) {
+      buffer_append(cleaned, log + pos, end - pos);
+      break;
+    }
+    size_t content = ref_content(config, log, pos, end);
+    if (content > 0) {
+      int k = ref_matching_identifier(config, log + pos, content);
+      if (k < 0)
+        buffer_append(cleaned, log + pos, end - pos);
+      else if (config->identifiers[k].bucket < 0)
+        buffer_append(removed, log + pos, end - pos);
+      else
+        buffer_append(&buckets[config->identifiers[k].bucket], log + pos, end - pos);
+    }
+    pos = end;
+  }
+}
+
+// ---- running a case ----
+
+// The records of buffer less the empty and padding ones, which any later run drops.
+// Empty lines within a record stay, so padding that would join a record shows.
+static Buffer without_padding(const RefConfig *config, const Buffer *buffer) {
+  Buffer records = {0};
+  buffer_append(&records, "", 0);
+  size_t pos = 0;
+  while (pos < buffer->len) {
+    size_t end = ref_record_end(config, buffer->data, buffer->len, pos);
+    size_t content = ref_content(config, buffer->data, pos, end);
+    if (content > 0 && !is_padding(buffer->data + pos, content))
+      buffer_append(&records, buffer->data + pos, end - pos);
+    pos = end;
+  }
+  return records;
+}
+
+// The outputs rebuilt from what lc_filter() reports
+typedef struct {
+  const RefConfig *config;
+  Buffer cleaned;
+  Buffer removed;
+  Buffer buckets[FUZZ_BUCKETS];
+} Filtered;
+
+static void on_record(const char *record, size_t len, int identifier, void *user_data) {
+  Filtered *filtered = user_data;
+  if (identifier < 0)
+    buffer_append(&filtered->cleaned, record, len);
+  else if (filtered->config->identifiers[identifier].bucket < 0)
+    buffer_append(&filtered->removed, record, len);
+  else
+    buffer_append(&filtered->buckets[filtered->config->identifiers[identifier].bucket], record, len);
+}
+
+static char work_dir[256];
+
+static Buffer read_file(const char *path) {
+  Buffer buffer = {0};
+  buffer_append(&buffer, "", 0);
+  FILE *fp = fopen(path, "rb");
+  if (!fp)
+    return buffer;
+  char chunk[4096];
+  size_t got;
+  while ((got = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+    buffer_append(&buffer, chunk, got);
+  fclose(fp);
+  return buffer;
+}
+
+// The output of clean_file() whose timestamped name starts with prefix. Missing files
+// read as NULL data, or as empty when optional, as sparse mode saves nothing when
+// nothing is removed.
+static Buffer read_output(const char *prefix, bool optional) {
+  Buffer buffer = {0};
+  DIR *dir = opendir(work_dir);
+  struct dirent *entry;
+  while (dir && (entry = readdir(dir)) != NULL) {
+    if (strncmp(entry->d_name, prefix, strlen(prefix)) == 0) {
+      char path[512];
+      snprintf(path, sizeof(path), "%s/%s", work_dir, entry->d_name);
+      buffer = read_file(path);
+      break;
+    }
+  }
+  if (dir)
+    closedir(dir);
+  if (buffer.data == NULL && optional)
+    buffer_append(&buffer, "", 0);
+  return buffer;
+}
+
+static void remove_outputs(void) {
+  DIR *dir = opendir(work_dir);
+  struct dirent *entry;
+  while (dir && (entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] == '.')
+      continue;
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", work_dir, entry->d_name);
+    unlink(path);
+  }
+  if (dir)
+    closedir(dir);
+}
+
+static void expect_same(const char *what, const Buffer *expected, const Buffer *actual, const char *config_path,
+                        const char *log, size_t size) {
+  if (actual->data != NULL && expected->len == actual->len &&
+      (expected->len == 0 || memcmp(expected->data, actual->data, expected->len) == 0))
+    return;
+
+  printf("Mismatch in the %s output: expected %zu bytes, got %s%zu bytes\n", what, expected->len,
+         actual->data == NULL ? "no file, " : "", actual->len);
+  Buffer config = read_file(config_path);
+  FILE *fp = fopen("fuzz-failure.json", "w");
+  if (fp) {
+    fwrite(config.data, 1, config.len, fp);
+    fclose(fp);
+  }
+  fp = fopen("fuzz-failure.log", "wb");
+  if (fp) {
+    fwrite(log, 1, size, fp);
+    fclose(fp);
+  }
+  printf("Case saved as fuzz-failure.json and fuzz-failure.log\n");
+  fflush(stdout);
+  abort();
+}
+
+// Run the log through lc_filter() too, and route the records it reports as the
+// reference did
+static void check_library(const RefConfig *ref, const char *config_path, const Buffer *log, const Buffer *cleaned,
+                          const Buffer *removed, const Buffer *buckets) {
+  Buffer json = read_file(config_path);
+  char err[512];
+  LogCleaner *cleaner;
+  if (lc_compile(json.data, json.len, "f.log", &cleaner, err, sizeof(err)) != LC_OK) {
+    printf("Generated config %s was rejected by lc_compile: %s\n", config_path, err);
+    fflush(stdout);
+    abort();
+  }
+  Filtered filtered = {.config = ref};
+  buffer_append(&filtered.cleaned, "", 0);
+  buffer_append(&filtered.removed, "", 0);
+  for (int i = 0; i < FUZZ_BUCKETS; i++)
+    buffer_append(&filtered.buckets[i], "", 0);
+  if (lc_filter(cleaner, log->data, log->len, on_record, &filtered) != LC_OK) {
+    printf("lc_filter failed\n");
+    fflush(stdout);
+    abort();
+  }
+  expect_same("lc_filter cleaned", cleaned, &filtered.cleaned, config_path, log->data, log->len);
+  expect_same("lc_filter removed", removed, &filtered.removed, config_path, log->data, log->len);
+  for (int i = 0; i < FUZZ_BUCKETS; i++)
+    expect_same("lc_filter bucket", &buckets[i], &filtered.buckets[i], config_path, log->data, log->len);
+  lc_free(cleaner);
+  free(json.data);
+  free(filtered.cleaned.data);
+  free(filtered.removed.data);
+  for (int i = 0; i < FUZZ_BUCKETS; i++)
+    free(filtered.buckets[i].data);
+}
+
+static void setup(void) {
+  if (work_dir[0])
+    return;
+  const char *tmp = getenv("TMPDIR");
+  snprintf(work_dir, sizeof(work_dir), "%s/log-cleaner-fuzz.XXXXXX", tmp ? tmp : "/tmp");
+  if (mkdtemp(work_dir) == NULL) {
+    printf("Unable to create a work directory in %s\n", tmp ? tmp : "/tmp");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void run_case(const uint8_t *data, size_t size) {
+  setup();
+  char config_path[512], log_path[512];
+  snprintf(config_path, sizeof(config_path), "%s/config.json", work_dir);
+  snprintf(log_path, sizeof(log_path), "%s/f.log", work_dir);
+
+  Bytes bytes = {data, size, 0};
+  RefConfig ref;
+  generate_config(&bytes, &ref, config_path);
+  Mode mode = pick(&bytes, MODE_COUNT);
+
+  Buffer body = {0};
+  buffer_append(&body, "", 0);
+  if (ref.json) {
+    generate_json_log(&bytes, &ref, &body);
+  } else {
+    for (size_t i = bytes.pos; i < size; i++)
+      buffer_append(&body, &log_alphabet[data[i] % (sizeof(log_alphabet) - 1)], 1);
+  }
+  Buffer log = {0};
+  buffer_append(&log, "", 0);
+  for (int r = 0; r < (mode == MODE_COMPACT ? 1 : FUZZ_IN_PLACE_REPEAT); r++)
+    buffer_append(&log, body.data, body.len);
+  free(body.data);
+  FILE *fp = fopen(log_path, "wb");
+  if (!fp || fwrite(log.data, 1, log.len, fp) != log.len || fclose(fp) != 0) {
+    printf("Unable to write %s\n", log_path);
+    exit(EXIT_FAILURE);
+  }
+
+  Buffer cleaned = {0}, removed = {0}, buckets[FUZZ_BUCKETS] = {{0}};
+  buffer_append(&cleaned, "", 0);
+  buffer_append(&removed, "", 0);
+  for (int i = 0; i < FUZZ_BUCKETS; i++)
+    buffer_append(&buckets[i], "", 0);
+  reference_clean(&ref, log.data, log.len, mode == MODE_LIVE, &cleaned, &removed, buckets);
+
+  Config *config;
+  char err[512];
+  if (load_config(config_path, "f.log", &config, err, sizeof(err)) != CONFIG_OK) {
+    printf("Generated config %s was rejected: %s\n", config_path, err);
+    fflush(stdout);
+    abort();
+  }
+  Settings settings = {.saveRemovedItems = true,
+                       .quiet = true,
+                       .sample_percent = 100,
+                       .live = mode == MODE_LIVE,
+                       .sparse = mode == MODE_SPARSE};
+  CleanStats stats;
+  if (!clean_file(log_path, config, settings, &stats, err, sizeof(err))) {
+    printf("Cleaning %s failed: %s\n", log_path, err);
+    fflush(stdout);
+    abort();
+  }
+
+  Buffer actual = read_file(log_path);
+  if (mode == MODE_COMPACT) {
+    expect_same("cleaned", &cleaned, &actual, config_path, log.data, log.len);
+  } else {
+    Buffer expected_lines = without_padding(&ref, &cleaned);
+    Buffer actual_lines = without_padding(&ref, &actual);
+    expect_same(mode == MODE_LIVE ? "live cleaned" : "sparse cleaned", &expected_lines, &actual_lines, config_path,
+                log.data, log.len);
+    free(expected_lines.data);
+    free(actual_lines.data);
+  }
+  free(actual.data);
+  actual = read_output("removed_f_", mode == MODE_SPARSE);
+  expect_same("removed", &removed, &actual, config_path, log.data, log.len);
+  free(actual.data);
+  for (int i = 0; i < config->bucket_count; i++) {
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "removed_%s_f_", config->buckets[i]);
+    actual = read_output(prefix, mode == MODE_SPARSE);
+    expect_same(config->buckets[i], &buckets[strcmp(config->buckets[i], "b1") == 0 ? 0 : 1], &actual, config_path,
+                log.data, log.len);
+    free(actual.data);
+  }
+
+  // live mode leaves the last record as it is, which lc_filter cleans
+  if (mode != MODE_LIVE)
+    check_library(&ref, config_path, &log, &cleaned, &removed, buckets);
+
+  delete_config(config);
+  free_ref_config(&ref);
+  remove_outputs();
+  free(log.data);
+  free(cleaned.data);
+  free(removed.data);
+  for (int i = 0; i < FUZZ_BUCKETS; i++)
+    free(buckets[i].data);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  run_case(data, size);
+  return 0;
+}
+
+#ifndef LOG_CLEANER_LIBFUZZER
+int main(int argc, char *argv[]) {
+  long iterations = argc > 1 ? atol(argv[1]) : 10000;
+  unsigned seed = argc > 2 ? (unsigned)strtoul(argv[2], NULL, 10) : (unsigned)time(NULL);
+  printf("Fuzzing %ld cases, seed %u\n", iterations, seed);
+
+  uint8_t data[1024];
+  for (long i = 0; i < iterations; i++) {
+    size_t size = rand_r(&seed) % sizeof(data);
+    for (size_t j = 0; j < size; j++)
+      data[j] = (uint8_t)rand_r(&seed);
+    run_case(data, size);
+  }
+
+  rmdir(work_dir);
+  printf("All %ld cases matched the reference\n", iterations);
+  return EXIT_SUCCESS;
+}
+#endif
@@ -0,0 +1,121 @@
+#define _GNU_SOURCE
+#include "inplace.h"
+#include "record.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// longest padding line, so that reading padding back never takes a large buffer
+#define PADDING_LINE_MAX 4096
+
+static int pwrite_all(int fd, const char *data, size_t len, off_t offset) {
+  while (len > 0) {
+    ssize_t written = pwrite(fd, data, len, offset);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return errno;
+    }
+    data += written;
+    len -= written;
+    offset += written;
+  }
+  return 0;
+}
+
+// Overwrite len bytes at offset with lines of a note padded with spaces, of at most
+// PADDING_LINE_MAX bytes each, or with a line of NUL bytes when there is no room for
+// the note. A single byte can only be the line ending, which callers avoid.
+static int write_padding(int fd, off_t offset, size_t len, char separator) {
+  char line[PADDING_LINE_MAX];
+  size_t note_len = strlen(PADDING_NOTE);
+  if (len <= note_len) {
+    memset(line, '\0', len - 1);
+    line[len - 1] = separator;
+    return pwrite_all(fd, line, len, offset);
+  }
+  memset(line, ' ', sizeof(line));
+  memcpy(line, PADDING_NOTE, note_len);
+
+  // lines of even length, so the last one is not too short for the note either
+  size_t count = (len + sizeof(line) - 1) / sizeof(line);
+  for (size_t i = 0; i < count; i++) {
+    size_t line_len = len / count + (i < len % count ? 1 : 0);
+    line[line_len - 1] = separator;
+    int error = pwrite_all(fd, line, line_len, offset);
+    if (error)
+      return error;
+    line[line_len - 1] = ' ';
+    offset += line_len;
+  }
+  return 0;
+}
+
+int pad_range(int fd, off_t start, off_t end, char separator) {
+  return end > start ? write_padding(fd, start, end - start, separator) : 0;
+}
+
+off_t file_block_size(int fd) {
+  struct stat st;
+  return fstat(fd, &st) == 0 && st.st_blksize > 0 ? st.st_blksize : 4096;
+}
+
+// The whole blocks [*first, *last) of [start, end) to collapse, one block fewer when
+// the bytes left over would be too short for the note. Empty when there are none.
+static void collapse_bounds(int fd, off_t start, off_t end, off_t *first, off_t *last) {
+  off_t block = file_block_size(fd);
+  *first = (start + block - 1) / block * block;
+  *last = end / block * block;
+  size_t rest = (*first - start) + (end - *last);
+  if (*last > *first && rest > 0 && rest <= strlen(PADDING_NOTE))
+    *last -= block;
+}
+
+off_t collapsible_bytes(int fd, off_t start, off_t end) {
+  off_t first, last;
+  collapse_bounds(fd, start, end, &first, &last);
+  return last > first ? last - first : 0;
+}
+
+int collapse_range(int fd, off_t start, off_t end, char separator) {
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+    return errno;
+  if (end >= st.st_size)
+    return EOPNOTSUPP;
+  off_t first, last;
+  collapse_bounds(fd, start, end, &first, &last);
+  if (last <= first)
+    return write_padding(fd, start, end - start, separator);
+
+  // EINVAL is taken as unsupported too, as on some file systems st_blksize is not
+  // the allocation unit collapsing needs
+  if (fallocate(fd, FALLOC_FL_COLLAPSE_RANGE, first, last - first) != 0)
+    return errno == EINVAL ? EOPNOTSUPP : errno;
+
+  // what is left of the range at either end is now in one piece at start
+  size_t residue = (first - start) + (end - last);
+  return residue > 0 ? write_padding(fd, start, residue, separator) : 0;
+}
+
+int cut_range(int fd, off_t start, off_t end, char separator) {
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+    return errno;
+  if (end >= st.st_size)
+    return ftruncate(fd, start) != 0 ? errno : 0;
+  return collapse_range(fd, start, end, separator);
+}
+
+int remove_range(int fd, off_t start, off_t end, char separator) {
+  if (end <= start)
+    return 0;
+  // the application may append at any moment, so the file is never truncated: a
+  // range that ends it, or that cannot be collapsed, is left as padding for a later
+  // run to drop
+  int error = collapse_range(fd, start, end, separator);
+  return error == EOPNOTSUPP ? write_padding(fd, start, end - start, separator) : error;
+}
@@ -0,0 +1,43 @@
+#ifndef INPLACE_H
+#define INPLACE_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Editing a log file in place, for live and sparse cleaning
+
+// A span of a file, such as a run of removed records
+typedef struct {
+  off_t start;
+  off_t end;
+} Range;
+
+// The allocation unit collapsing works in
+off_t file_block_size(int fd);
+
+// The bytes collapse_range() cuts out of [start, end), its whole blocks
+off_t collapsible_bytes(int fd, off_t start, off_t end);
+
+// Collapse the whole file system blocks of [start, end) out of the file with
+// FALLOC_FL_COLLAPSE_RANGE. The bytes of the range left over at either end become
+// padding: short lines holding a note, or NUL bytes when there is no room for it,
+// so the file stays a sequence of lines. A block more is kept rather than leave too
+// little for the note; a range without a whole block to spare is all padding. The
+// range must not reach the end of the file. Returns 0, or an errno, EOPNOTSUPP when the file system cannot
+// collapse or the range reaches the end; the file is unchanged then.
+int collapse_range(int fd, off_t start, off_t end, char separator);
+
+// Overwrite [start, end) with padding. Returns 0 or an errno.
+int pad_range(int fd, off_t start, off_t end, char separator);
+
+// Cut [start, end) out of a file nothing else writes to: truncate it when the range
+// ends it, otherwise as collapse_range. Returns 0 or an errno.
+int cut_range(int fd, off_t start, off_t end, char separator);
+
+// Remove [start, end) from a file that may still be growing: by collapsing it when
+// data follows it, otherwise by padding it, as truncating could lose an append.
+// Padding at the end of the file is dropped by a later run, once entries follow
+// it. Returns 0 or an errno.
+int remove_range(int fd, off_t start, off_t end, char separator);
+
+#endif
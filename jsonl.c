@@ -0,0 +1,126 @@
+#include "jsonl.h"
+#include <string.h>
+
+static inline bool is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static const char *skip_space(const char *p, const char *end) {
+  while (p < end && is_space(*p))
+    p++;
+  return p;
+}
+
+// Past the closing quote of the string opening at p, NULL when it is unterminated.
+// A quote closes the string when an even number of backslashes precede it.
+static const char *skip_string(const char *p, const char *end) {
+  for (p++; p < end;) {
+    const char *quote = memchr(p, '"', end - p);
+    if (quote == NULL)
+      return NULL;
+    const char *escapes = quote;
+    while (escapes > p && escapes[-1] == '\\')
+      escapes--;
+    if ((quote - escapes) % 2 == 0)
+      return quote + 1;
+    p = quote + 1;
+  }
+  return NULL;
+}
+
+// Past the end of the value starting at p, NULL when it is cut short
+static const char *skip_value(const char *p, const char *end) {
+  if (*p == '"')
+    return skip_string(p, end);
+
+  if (*p == '{' || *p == '[') {
+    int depth = 0;
+    for (; p < end; p++) {
+      switch (*p) {
+      case '"':
+        p = skip_string(p, end);
+        if (p == NULL)
+          return NULL;
+        p--;
+        break;
+      case '{':
+      case '[':
+        depth++;
+        break;
+      case '}':
+      case ']':
+        if (--depth == 0)
+          return p + 1;
+        break;
+      }
+    }
+    return NULL;
+  }
+
+  // number, true, false or null
+  const char *start = p;
+  while (p < end && *p != ',' && *p != '}' && *p != ']' && !is_space(*p))
+    p++;
+  return p > start ? p : NULL;
+}
+
+// Span of the value of the member named key, as written, in the object at p
+static bool find_member(const char *p, const char *end, const char *key, size_t key_len, const char **value,
+                        const char **value_end) {
+  p = skip_space(p, end);
+  if (p == end || *p != '{')
+    return false;
+  p = skip_space(p + 1, end);
+  while (p < end && *p == '"') {
+    const char *name_end = skip_string(p, end);
+    if (name_end == NULL)
+      return false;
+    bool found = (size_t)(name_end - p - 2) == key_len && memcmp(p + 1, key, key_len) == 0;
+    p = skip_space(name_end, end);
+    if (p == end || *p != ':')
+      return false;
+    p = skip_space(p + 1, end);
+    if (p == end)
+      return false;
+    const char *member_end = skip_value(p, end);
+    if (member_end == NULL)
+      return false;
+    if (found) {
+      *value = p;
+      *value_end = member_end;
+      return true;
+    }
+    p = skip_space(member_end, end);
+    if (p == end || *p != ',')
+      return false;
+    p = skip_space(p + 1, end);
+  }
+  return false;
+}
+
+bool find_json_key(const char **text, size_t *len, const char *path, size_t path_len) {
+  const char *p = *text;
+  const char *end = p + *len;
+  const char *path_end = path + path_len;
+  for (;;) {
+    const char *dot = memchr(path, '.', path_end - path);
+    const char *key_end = dot ? dot : path_end;
+    const char *value;
+    const char *value_end;
+    if (!find_member(p, end, path, key_end - path, &value, &value_end))
+      return false;
+    if (dot == NULL) {
+      if (*value == '"') {
+        value++;
+        value_end--;
+      }
+      *text = value;
+      *len = value_end - value;
+      return true;
+    }
+    // the next key is looked up within this value
+    p = value;
+    end = value_end;
+    path = dot + 1;
+  }
+}
@@ -0,0 +1,16 @@
+#ifndef JSONL_H
+#define JSONL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Key scoped matching in JSON-lines logs, one JSON object per entry
+
+// Narrow text/len down to the value at a dot separated key path, such as
+// "http.status", in the JSON object the entry holds. A string value is given
+// without its quotes, its escapes as written; any other value as its JSON text.
+// False when the entry is not an object or has no such key. Only the objects along
+// the path are scanned, the other values are skipped over, and nothing is allocated.
+bool find_json_key(const char **text, size_t *len, const char *path, size_t path_len);
+
+#endif
@@ -0,0 +1,157 @@
+#define _GNU_SOURCE
+#include "logcleaner.h"
+#include "config.h"
+#include "match.h"
+#include "record.h"
+#include "util.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A MatchState not in use by any lc_filter call, kept for the next one
+typedef struct FreeState {
+  MatchState *state;
+  struct FreeState *next;
+} FreeState;
+
+struct LogCleaner {
+  Config *config;
+  // the lazily built DFAs of each MatchState are per thread, so concurrent calls take
+  // a state each from this list, or make a new one
+  pthread_mutex_t lock;
+  FreeState *free_states;
+};
+
+static LcStatus from_config_status(ConfigStatus status) {
+  switch (status) {
+  case CONFIG_OK:
+    return LC_OK;
+  case CONFIG_UNREADABLE:
+    return LC_ERROR_CONFIG_FILE;
+  case CONFIG_NO_SECTION:
+    return LC_ERROR_NO_SECTION;
+  case CONFIG_INVALID:
+  default:
+    return LC_ERROR_CONFIG;
+  }
+}
+
+static LcStatus wrap_config(Config *config, ConfigStatus status, LogCleaner **cleaner) {
+  *cleaner = NULL;
+  if (status != CONFIG_OK)
+    return from_config_status(status);
+
+  LogCleaner *compiled = NULL;
+  compiled = m_alloc(compiled, sizeof(LogCleaner), "log cleaner");
+  if (compiled == NULL) {
+    delete_config(config);
+    return LC_ERROR_MEMORY;
+  }
+  compiled->config = config;
+  pthread_mutex_init(&compiled->lock, NULL);
+  compiled->free_states = NULL;
+  *cleaner = compiled;
+  return LC_OK;
+}
+
+LcStatus lc_compile_file(const char *config_file, const char *section, LogCleaner **cleaner, char *err,
+                         size_t err_len) {
+  if (config_file == NULL || section == NULL || cleaner == NULL)
+    return LC_ERROR_ARGUMENT;
+  char unused[1];
+  Config *config;
+  ConfigStatus status = load_config(config_file, section, &config, err ? err : unused, err ? err_len : 1);
+  return wrap_config(config, status, cleaner);
+}
+
+LcStatus lc_compile(const char *json, size_t len, const char *section, LogCleaner **cleaner, char *err,
+                    size_t err_len) {
+  if (json == NULL || section == NULL || cleaner == NULL)
+    return LC_ERROR_ARGUMENT;
+  char unused[1];
+  Config *config;
+  ConfigStatus status = parse_config(json, len, section, &config, err ? err : unused, err ? err_len : 1);
+  return wrap_config(config, status, cleaner);
+}
+
+void lc_free(LogCleaner *cleaner) {
+  if (cleaner == NULL)
+    return;
+  while (cleaner->free_states) {
+    FreeState *next = cleaner->free_states->next;
+    match_state_free(cleaner->free_states->state);
+    free(cleaner->free_states);
+    cleaner->free_states = next;
+  }
+  pthread_mutex_destroy(&cleaner->lock);
+  delete_config(cleaner->config);
+  free(cleaner);
+}
+
+// NULL when memory runs out
+static FreeState *take_state(LogCleaner *cleaner) {
+  pthread_mutex_lock(&cleaner->lock);
+  FreeState *entry = cleaner->free_states;
+  if (entry)
+    cleaner->free_states = entry->next;
+  pthread_mutex_unlock(&cleaner->lock);
+  if (entry)
+    return entry;
+
+  entry = m_alloc(entry, sizeof(FreeState), "match state");
+  if (entry == NULL)
+    return NULL;
+  entry->state = match_state_new(cleaner->config);
+  if (entry->state == NULL) {
+    free(entry);
+    return NULL;
+  }
+  return entry;
+}
+
+static void return_state(LogCleaner *cleaner, FreeState *entry) {
+  pthread_mutex_lock(&cleaner->lock);
+  entry->next = cleaner->free_states;
+  cleaner->free_states = entry;
+  pthread_mutex_unlock(&cleaner->lock);
+}
+
+LcStatus lc_filter(LogCleaner *cleaner, const char *buffer, size_t len, LcRecordCallback callback, void *user_data) {
+  if (cleaner == NULL || (buffer == NULL && len > 0) || callback == NULL)
+    return LC_ERROR_ARGUMENT;
+
+  const Config *config = cleaner->config;
+  FreeState *entry = take_state(cleaner);
+  if (entry == NULL)
+    return LC_ERROR_MEMORY;
+  Record record;
+  size_t pos = 0;
+  while (split_record(buffer + pos, len - pos, config->line_separator, config->record_start, config->record_start_len,
+                      true, &record)) {
+    if (record.content_len > 0)
+      callback(record.data, record.len, matching_identifier(record.data, record.content_len, config, entry->state),
+               user_data);
+    pos += record.len;
+  }
+  return_state(cleaner, entry);
+  return LC_OK;
+}
+
+const char *lc_status_string(LcStatus status) {
+  switch (status) {
+  case LC_OK:
+    return "ok";
+  case LC_ERROR_ARGUMENT:
+    return "missing argument";
+  case LC_ERROR_CONFIG_FILE:
+    return "config file could not be opened";
+  case LC_ERROR_CONFIG:
+    return "invalid config";
+  case LC_ERROR_NO_SECTION:
+    return "no such section in the config";
+  case LC_ERROR_MEMORY:
+    return "out of memory";
+  }
+  return "unknown status";
+}
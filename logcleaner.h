@@ -0,0 +1,60 @@
+#ifndef LOGCLEANER_H
+#define LOGCLEANER_H
+
+// liblogcleaner: the log-cleaner matching engine, for filtering log records in
+// memory inside another program (e.g. a log shipper) before they reach disk.
+//
+//   LogCleaner *cleaner;
+//   char err[256];
+//   if (lc_compile_file("log-cleaner-config.json", "app.log", &cleaner, err, sizeof(err)) != LC_OK)
+//     fprintf(stderr, "%s\n", err);
+//   lc_filter(cleaner, buffer, len, on_record, shipper);
+//   lc_free(cleaner);
+//
+// A compiled LogCleaner can be shared: lc_filter may be called on it from any
+// number of threads at once. Config problems come back as an LcStatus and a
+// message rather than ending the process.
+
+#include <stddef.h>
+
+// Only these calls are exported. The engine and the cJSON it is built with stay
+// internal to the library, so they cannot clash with the host program's own.
+#ifdef __GNUC__
+#define LC_API __attribute__((visibility("default")))
+#else
+#define LC_API
+#endif
+
+typedef struct LogCleaner LogCleaner;
+
+typedef enum {
+  LC_OK = 0,
+  LC_ERROR_ARGUMENT,    // a required pointer was NULL
+  LC_ERROR_CONFIG_FILE, // the config file could not be opened
+  LC_ERROR_CONFIG,      // the config is not valid, err says why
+  LC_ERROR_NO_SECTION,  // the config has no section of the given name
+  LC_ERROR_MEMORY       // memory ran out, nothing was filtered
+} LcStatus;
+
+// Called for each record of a filtered buffer, in order. record and len span the
+// record including its line ending. identifier is the index of the identifier
+// that matched it, so the record would be removed, or -1 when it is kept.
+typedef void (*LcRecordCallback)(const char *record, size_t len, int identifier, void *user_data);
+
+// Compile one section of a config, from a file or from JSON text in memory. On
+// failure err (when not NULL) describes the problem.
+LC_API LcStatus lc_compile_file(const char *config_file, const char *section, LogCleaner **cleaner, char *err,
+                                size_t err_len);
+LC_API LcStatus lc_compile(const char *json, size_t len, const char *section, LogCleaner **cleaner, char *err,
+                           size_t err_len);
+LC_API void lc_free(LogCleaner *cleaner);
+
+// Split buffer into records, by the section's line separator and record_start,
+// and report each one that is not blank to callback. A final line without a
+// line ending counts as a whole record.
+LC_API LcStatus lc_filter(LogCleaner *cleaner, const char *buffer, size_t len, LcRecordCallback callback,
+                          void *user_data);
+
+LC_API const char *lc_status_string(LcStatus status);
+
+#endif
@@ -1,246 +1,94 @@
 #define _GNU_SOURCE
-#include "cJSON.h"
+#include "clean.h"
+#include "config.h"
+#include "daemon.h"
+#include "dryrun.h"
+#include "perfcount.h"
+#include "util.h"
 #include <getopt.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
+#include <unistd.h>
 #define VERSION "v1.0.0"
-// program limitation: max config size of 4k
-#define MAX_CONFIG_FILE_SIZE 4096
 
-typedef struct {
-  char **items;
-  int length;
-} Identifier;
-
-typedef struct {
-  char *log_file;
-  Identifier **identifiers;
-  int identifier_count;
-} Config;
-
-typedef struct {
-  char *file_path;
-  char *config_file;
-  bool saveRemovedItems;
-} Settings;
-
-void clean_file(const char *file_path, const Config *config, Settings settings);
-char *create_timestamped_file_path(const char *filename, const char *prefix);
-void delete_config(Config *config);
-Config *get_config(const char *log_file_name, char *config_file);
-const char *get_filename(const char *path);
-void *m_alloc(void *ptr, size_t size, const char *err_msg);
 void processArgs(int argc, char **argv, Settings *setttings);
 void show_usage();
+static bool process_file(const char *file_path, Settings settings);
+static void print_perf_report(const PerfPhase *load, const CleanStats *stats, Settings settings);
 
 int main(int argc, char *argv[]) {
 
-  Settings settings = {.saveRemovedItems = false};
+  Settings settings = {.saveRemovedItems = false, .sample_percent = 100};
   processArgs(argc, argv, &settings);
 
-  char *file_path = settings.file_path;
-  const char *filename = get_filename(file_path);
-  char *config_file = settings.config_file;
-
-  Config *config = get_config(filename, config_file);
-  if (config == NULL) {
-    printf("Could not find config information for log file '%s'.\nCheck the "
-           "'%s' file for a '%s' section.\n",
-           filename, config_file, filename);
-    exit(EXIT_FAILURE);
+  if (settings.daemon)
+    return run_daemon(settings.socket_path, settings.config_file, settings.threads);
+
+  if (settings.perf_counters && !settings.dry_run)
+    settings.counters = perf_counters_open();
+
+  // a file that fails is reported and skipped, so one locked or unreadable file
+  // does not hold up the rest of the batch
+  int failed = 0;
+  for (int i = 0; i < settings.file_count; i++) {
+    bool ok;
+    if (settings.socket_path)
+      ok = submit_to_daemon(settings.socket_path, settings.file_paths[i], &settings) == EXIT_SUCCESS;
+    else
+      ok = process_file(settings.file_paths[i], settings);
+    if (!ok)
+      failed++;
   }
 
-  clean_file(file_path, config, settings);
-  delete_config(config);
-
-  return EXIT_SUCCESS;
+  if (settings.counters)
+    perf_counters_close(settings.counters);
+  if (failed > 0 && settings.file_count > 1)
+    printf("%d of %d log files failed\n", failed, settings.file_count);
+  return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
-void clean_file(const char *file_path, const Config *config, Settings settings) {
-  FILE *log_file_ptr;
-  log_file_ptr = fopen(file_path, "rb");
-  if (log_file_ptr == NULL) {
-    printf("Error opening file: %s", file_path);
-    exit(EXIT_FAILURE);
-  }
-
-  char *cleaned_filename = create_timestamped_file_path(file_path, "cleaned");
-  FILE *cleaned_filePtr;
-  cleaned_filePtr = fopen(cleaned_filename, "w");
-  if (cleaned_filePtr == NULL) {
-    printf("Error opening %s\n", cleaned_filename);
-    exit(EXIT_FAILURE);
-  }
-
-  FILE *removed_filePtr = NULL;
-  char *removed_filename = NULL;
-  if (settings.saveRemovedItems) {
-    removed_filename = create_timestamped_file_path(file_path, "removed");
-    removed_filePtr = fopen(removed_filename, "w");
-    if (removed_filePtr == NULL) {
-      printf("Error opening %s\n", removed_filename);
-      exit(EXIT_FAILURE);
-    }
-  }
-
-  int str_len;
-  char *log_entry = NULL;
-  size_t len = 0;
-  while ((str_len = (int)getline(&log_entry, &len, log_file_ptr)) != -1) {
-    log_entry[str_len - 1] = '\0';
-    if (strcmp(log_entry, "\0") == 0) // ignore empty strings
-      continue;
-
-    bool match = true;
-    for (int k = 0; k < config->identifier_count; k++) {
-      match = true;
-      for (int l = 0; l < config->identifiers[k]->length; l++) {
-        if (strstr(log_entry, config->identifiers[k]->items[l]) == NULL) {
-          match = false;
-          break;
-        }
-      }
-      if (match)
-        break;
-    }
-
-    if (match) {
-      if (settings.saveRemovedItems)
-        fprintf(removed_filePtr, "%s\n", log_entry);
-      printf("Removed: %s\n", log_entry);
-    } else {
-      fprintf(cleaned_filePtr, "%s\n", log_entry);
-    }
-  }
-
-  if (log_entry)
-    free(log_entry);
-
-  if (settings.saveRemovedItems)
-    fclose(removed_filePtr);
-  fclose(cleaned_filePtr);
-  fclose(log_file_ptr);
-
-  if (rename(cleaned_filename, file_path) != 0) {
-    printf("Unable to replace '%s' with the cleaned log file '%s'.\nFile is "
-           "likely locked by another process.\nThis file will need to be replaced manually.\n",
-           file_path, cleaned_filename);
-  }
-
-  if (settings.saveRemovedItems)
-    free(removed_filename);
-  free(cleaned_filename);
-}
-
-Config *get_config(const char *log_file_name, char *config_file) {
-  FILE *fp = fopen(config_file, "r");
-  if (!fp) {
-    printf("Error: Unable to open the file %s. Check spelling and that it "
-           "exists.\n",
-           config_file);
-    exit(EXIT_FAILURE);
-  }
-
-  char json_string[MAX_CONFIG_FILE_SIZE];
-  int len = fread(json_string, 1, sizeof(json_string) - 1, fp);
-  fclose(fp);
+// Clean, or dry run, one log file with its section of the config
+static bool process_file(const char *file_path, Settings settings) {
+  const char *filename = get_filename(file_path);
+  char *config_file = settings.config_file;
+  char err[512];
 
-  if (len <= 0) {
-    printf("No config set in config file '%s'", config_file);
-    exit(EXIT_FAILURE);
+  PerfPhase load;
+  if (settings.counters) {
+    perf_phase_init(&load, settings.counters);
+    perf_phase_begin(&load);
   }
-
-  // null terminate json_string
-  json_string[len] = '\0';
-
-  cJSON *root = cJSON_Parse(json_string);
-  if (!root) {
-    printf("Parse error: %s\n", cJSON_GetErrorPtr());
-    exit(EXIT_FAILURE);
+  Config *config;
+  ConfigStatus status = load_config(config_file, filename, &config, err, sizeof(err));
+  if (settings.counters)
+    perf_phase_end(&load);
+  if (status == CONFIG_NO_SECTION) {
+    printf("Could not find config information for log file '%s'.\nCheck the "
+           "'%s' file for a '%s' section.\n",
+           filename, config_file, filename);
+    return false;
   }
-  
-  cJSON *files = cJSON_GetObjectItemCaseSensitive(root, "files");
-  if (!cJSON_IsObject(files)) {
-    printf("Invalid 'files' object.\n");
-    cJSON_Delete(root);
-    exit(EXIT_FAILURE);
+  if (status != CONFIG_OK) {
+    printf("%s\n", err);
+    return false;
   }
 
-  Config *config = NULL;
-
-  cJSON *log_file;
-  cJSON_ArrayForEach(log_file, files) {
-    if (strcmp(log_file->string, log_file_name) != 0)
-      continue;
-
-    config = m_alloc(config, sizeof(Config), "config item");
-    config->log_file = NULL;
-    config->log_file = m_alloc(config->log_file, strlen(log_file->string) + 1, "log file name in config");
-    strcpy(config->log_file, log_file->string);
-
-    cJSON *array = log_file;
-    int size = cJSON_GetArraySize(array);
-    if (size <= 0) { // error in config
-      printf("No identifier items set for %s in config", log_file_name);
-      exit(EXIT_FAILURE);
-    }
-
-    config->identifiers = NULL;
-    config->identifiers = m_alloc(config->identifiers, size * sizeof(Identifier *), "identifiers list");
-    config->identifier_count = size;
-
-    for (int i = 0; i < size; i++) {
-
-      cJSON *inner_array = cJSON_GetArrayItem(array, i);
-      if (!cJSON_IsArray(inner_array))
-        continue;
-
-      Identifier *identifier = NULL;
-      identifier = m_alloc(identifier, sizeof(Identifier), "config identifier");
-      config->identifiers[i] = identifier;
-
-      int inner_size = cJSON_GetArraySize(inner_array);
-      identifier->length = inner_size;
-      if (inner_size <= 0)
-        continue;
-
-      identifier->items = NULL;
-      identifier->items = m_alloc(identifier->items, inner_size * sizeof(char *), "identifier items");
-
-      for (int j = 0; j < inner_size; j++) {
-        cJSON *item = cJSON_GetArrayItem(inner_array, j);
-        if (cJSON_IsString(item)) {
-          char *str = NULL;
-          str = m_alloc(str, strlen(item->valuestring) + 1, "item string in config");
-          strcpy(str, item->valuestring);
-          config->identifiers[i]->items[j] = str;
-        }
-      }
-    }
-    break;
-  }
-
-  cJSON_Delete(root);
-
-  return config;
-}
-
-// Free the memory allocated to config
-void delete_config(Config *config) {
-  for (int i = 0; i < config->identifier_count; i++) {
-    for (int j = 0; j < config->identifiers[i]->length; j++) {
-      free(config->identifiers[i]->items[j]);
-    }
-    free(config->identifiers[i]->items);
-    free(config->identifiers[i]);
+  bool ok;
+  if (settings.dry_run) {
+    ok = dry_run_file(file_path, config, settings.sample_percent, err, sizeof(err));
+  } else {
+    CleanStats stats;
+    ok = clean_file(file_path, config, settings, &stats, err, sizeof(err));
+    if (ok && settings.counters)
+      print_perf_report(&load, &stats, settings);
   }
-  free(config->log_file);
-  free(config->identifiers);
-  free(config);
+  if (!ok)
+    printf("%s\n", err);
+  delete_config(config);
+  return ok;
 }
 
 void processArgs(int argc, char *argv[], Settings *settings) {
@@ -250,15 +98,68 @@ void processArgs(int argc, char *argv[], Settings *settings) {
   static struct option long_options[] = {
       {"help",    no_argument, NULL, 'h'},
       {"version", no_argument, NULL, 'v'},
-      {"retain",  no_argument, NULL, 'r'},
-      {0,         0,           0,    0  }
+      {"retain",  no_argument,       NULL, 'r'},
+      {"daemon",  no_argument,       NULL, 'd'},
+      {"socket",  required_argument, NULL, 's'},
+      {"threads", required_argument, NULL, 't'},
+      {"dry-run", no_argument,       NULL, 'n'},
+      {"sample",  required_argument, NULL, 'p'},
+      {"perf-counters", no_argument, NULL, 'c'},
+      {"no-fsync", no_argument,      NULL, 'f'},
+      {"live",    no_argument,       NULL, 'l'},
+      {"sparse",  no_argument,       NULL, 'S'},
+      {"index",   no_argument,       NULL, 'i'},
+      {"extract", no_argument,       NULL, 'x'},
+      {0,         0,                 0,    0  }
   };
 
-  while ((ch = getopt_long(argc, argv, "hvr", long_options, NULL)) != -1) {
+  while ((ch = getopt_long(argc, argv, "hvrds:t:np:cflSix", long_options, NULL)) != -1) {
     switch (ch) {
     case 'r':
       settings->saveRemovedItems = true;
       break;
+    case 'd':
+      settings->daemon = true;
+      break;
+    case 's':
+      settings->socket_path = optarg;
+      break;
+    case 't':
+      settings->threads = atoi(optarg);
+      if (settings->threads < 1) {
+        fprintf(stderr, "Error: --threads must be at least 1.\n");
+        show_usage();
+      }
+      break;
+    case 'n':
+      settings->dry_run = true;
+      break;
+    case 'p':
+      settings->dry_run = true;
+      settings->sample_percent = atof(optarg);
+      if (settings->sample_percent <= 0 || settings->sample_percent > 100) {
+        fprintf(stderr, "Error: --sample must be a percentage above 0 and up to 100.\n");
+        show_usage();
+      }
+      break;
+    case 'c':
+      settings->perf_counters = true;
+      break;
+    case 'f':
+      settings->no_fsync = true;
+      break;
+    case 'l':
+      settings->live = true;
+      break;
+    case 'S':
+      settings->sparse = true;
+      break;
+    case 'i':
+      settings->index = true;
+      break;
+    case 'x':
+      settings->extract = true;
+      break;
     case 'v':
       printf("%s\n", VERSION);
       exit(EXIT_SUCCESS);
@@ -268,69 +169,105 @@ void processArgs(int argc, char *argv[], Settings *settings) {
     }
   }
 
-  // Process positional arguments
+  if (settings->daemon && settings->socket_path == NULL) {
+    fprintf(stderr, "Error: --daemon requires --socket.\n");
+    show_usage();
+  }
+  if (settings->perf_counters && (settings->daemon || settings->socket_path || settings->dry_run)) {
+    fprintf(stderr, "Error: --perf-counters only applies when cleaning a file directly.\n");
+    show_usage();
+  }
+  if (settings->dry_run && (settings->daemon || settings->socket_path)) {
+    fprintf(stderr, "Error: --dry-run cannot be used with --daemon or --socket.\n");
+    show_usage();
+  }
+  if (settings->live && settings->sparse) {
+    fprintf(stderr, "Error: --live and --sparse cannot be used together.\n");
+    show_usage();
+  }
+  if (settings->extract && (settings->live || settings->sparse || settings->dry_run)) {
+    fprintf(stderr, "Error: --extract cannot be used with --live, --sparse or --dry-run.\n");
+    show_usage();
+  }
+  if (settings->index && !settings->saveRemovedItems && !settings->extract) {
+    fprintf(stderr, "Error: --index requires --retain or --extract.\n");
+    show_usage();
+  }
+  if (settings->threads == 0)
+    settings->threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+  // Process positional arguments. The daemon only needs the config and jobs sent
+  // to the daemon only need the log files, as the daemon already has the config.
+  if (settings->daemon || settings->socket_path) {
+    if (optind + 1 > argc) {
+      fprintf(stderr, "Error: A file path is required.\n");
+      show_usage();
+    }
+    if (settings->daemon) {
+      settings->config_file = argv[optind];
+    } else {
+      settings->file_paths = &argv[optind];
+      settings->file_count = argc - optind;
+    }
+    return;
+  }
+
   if (optind + 2 > argc) {
-    fprintf(stderr, "Error: Two file paths are required.\n");
+    fprintf(stderr, "Error: At least two file paths are required.\n");
     show_usage();
   }
-  
-  settings->file_path = argv[optind];
-  settings->config_file = argv[optind + 1];
+
+  // any number of log files, followed by the config
+  settings->file_paths = &argv[optind];
+  settings->file_count = argc - optind - 1;
+  settings->config_file = argv[argc - 1];
 }
 
 void show_usage() {
-  printf("Usage: log-cleaner [options] <log_filepath> <config_filepath>\n");
+  printf("Usage: log-cleaner [options] <log_filepath>... <config_filepath>\n");
+  printf("       log-cleaner --daemon --socket <socket_path> [--threads <n>] <config_filepath>\n");
+  printf("       log-cleaner --socket <socket_path> [--retain [--index]] [--live | --sparse | --extract] [--no-fsync] <log_filepath>...\n");
   printf("Options:\n");
   printf("  --help, -h     Show this help message\n");
   printf("  --version, -v  Show version information\n");
   printf("  --retain, -r   Saves the removed log entries to a separate file in the same directory\n\t\t as the "
          "original log "
          "file. 'removed_<log_file_name>_<timestamp>.log'\n\t\t Default: false\n");
+  printf("  --extract, -x  Leave the log file as it is and write the entries the config matches to\n\t\t "
+         "'extracted_<log_file_name>_<timestamp>.log', and bucket files, instead\n");
+  printf("  --index, -i    With --retain or --extract, also write an index of each file of entries, one\n\t\t "
+         "line per entry with its offset in the file and the identifier that matched it,\n\t\t "
+         "'removed_<log_file_name>_<timestamp>.idx'\n");
+  printf("  --daemon, -d   Run as a daemon that keeps the whole config loaded and cleans the log files\n\t\t "
+         "sent to it over --socket\n");
+  printf("  --socket, -s   Unix socket of the daemon. Without --daemon, sends the log file to the\n\t\t "
+         "daemon to be cleaned instead of cleaning it here\n");
+  printf("  --threads, -t  Number of files the daemon cleans at once. Default: number of CPUs\n");
+  printf("  --dry-run, -n  Report how many entries and bytes would be kept and removed, per identifier,\n\t\t "
+         "without changing the log file\n");
+  printf("  --sample, -p   Dry run reading only this percentage of the file, in randomly picked 1 MB\n\t\t "
+         "blocks, and estimate the totals from them. Implies --dry-run\n");
+  printf("  --live, -l     Clean log files that are still being written to in place, keeping the entries\n\t\t "
+         "appended while cleaning. Use when the owner appends with O_APPEND, as most loggers do\n");
+  printf("  --sparse, -S   Cut the runs of removed entries out of the log file in place instead of\n\t\t "
+         "rewriting it, for large files with little noise. Falls back to a normal clean where\n\t\t "
+         "the file system cannot collapse ranges\n");
+  printf("  --no-fsync, -f Skip syncing the cleaned and removed files to disk before the log file is\n\t\t "
+         "replaced. Faster, but a crash or power loss can lose log entries\n");
+  printf("  --perf-counters, -c\n\t\t Report CPU cycles, instructions, cache and branch misses for loading the\n\t\t "
+         "config, scanning and writing, from the hardware performance counters\n");
   exit(EXIT_SUCCESS);
 }
 
-const char *get_filename(const char *path) {
-  const char *last_slash = strrchr(path, '/');
-  return last_slash ? last_slash + 1 : path;
-}
-
-char *create_timestamped_file_path(const char *file_path, const char *prefix) {
-  char base[256] = {0};
-  char timestamp[20];
-  char *ext;
-  time_t now = time(NULL);
-  struct tm *t = localtime(&now);
-
-  const char *fname = get_filename(file_path);
-
-  ext = strrchr(fname, '.');
-  if (ext && strcmp(ext, ".log") == 0) {
-    size_t len = ext - fname;
-    strncpy(base, fname, len);
-    base[len] = '\0';
-  } else {
-    strcpy(base, fname);
-  }
-
-  strftime(timestamp, sizeof(timestamp), "%Y%m%d_%H%M%S", t);
-
-  size_t dir_len = fname - file_path;
-  size_t new_len = dir_len + strlen(prefix) + 1 + strlen(base) + 1 + strlen(timestamp) + 5; // +5 for "_", ".log", \0
-  char *new_file_path = NULL;
-  new_file_path = m_alloc(new_file_path, new_len, "new file path");
-
-  snprintf(new_file_path, new_len, "%.*s%s_%s_%s.log", (int)dir_len, file_path, prefix, base, timestamp);
-
-  return new_file_path; // Caller must free()
-}
-
-void *m_alloc(void *ptr, size_t size, const char *field_name) {
-  ptr = malloc(size);
-
-  if (ptr == NULL) {
-    printf("Unable to allocate memory for %s\n", field_name);
-    exit(EXIT_FAILURE);
-  }
-
-  return ptr;
+// Counters per phase. Scan covers reading and matching, write the output syscalls.
+static void print_perf_report(const PerfPhase *load, const CleanStats *stats, Settings settings) {
+  double scanned = stats->kept_bytes + stats->removed_bytes;
+  double written = (settings.extract || stats->sparse ? 0 : stats->kept_bytes) +
+                   (settings.saveRemovedItems || settings.extract ? stats->removed_bytes : 0);
+  printf("\nPerformance counters%s:\n", load->counters->user_only ? " (user space only)" : "");
+  printf("%-7s %9s %14s %14s %14s %14s %5s %14s\n", "phase", "seconds", "cycles", "instructions", "cache-misses",
+         "branch-misses", "IPC", "throughput");
+  perf_phase_print("config", load, 0);
+  perf_phase_print("scan", &stats->scan, scanned);
+  perf_phase_print("write", &stats->write, written);
 }
@@ -0,0 +1,193 @@
+#define _GNU_SOURCE
+#include "match.h"
+#include "jsonl.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static inline unsigned char fold(unsigned char c) {
+  return (c >= 'A' && c <= 'Z') ? c | 0x20 : c;
+}
+
+// Compare text against an already lower-cased string, ignoring ASCII case
+static bool fold_equal(const char *text, const char *lower, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if (fold(text[i]) != (unsigned char)lower[i])
+      return false;
+  }
+  return true;
+}
+
+#ifdef __SSE2__
+// Lower-case the ASCII letters of 16 bytes at once
+static inline __m128i fold_block(__m128i v) {
+  // shift 'A'..'Z' onto the bottom of the signed range so one signed compare finds them
+  const __m128i shifted = _mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - 'A')));
+  const __m128i upper = _mm_cmplt_epi8(shifted, _mm_set1_epi8((char)(0x80 + 26)));
+  return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+#endif
+
+// Case-insensitive memmem. Candidates are found 16 positions at a time by comparing
+// the folded first and last needle bytes, then verified byte by byte.
+static const char *icase_search(const char *text, size_t len, const char *lower, size_t n) {
+  if (n == 0)
+    return text;
+  if (n > len)
+    return NULL;
+
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128i first = _mm_set1_epi8(lower[0]);
+  const __m128i last = _mm_set1_epi8(lower[n - 1]);
+  for (; i + n - 1 + 16 <= len; i += 16) {
+    __m128i a = fold_block(_mm_loadu_si128((const __m128i *)(text + i)));
+    __m128i b = fold_block(_mm_loadu_si128((const __m128i *)(text + i + n - 1)));
+    unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+    while (mask) {
+      int bit = __builtin_ctz(mask);
+      if (n <= 2 || fold_equal(text + i + bit + 1, lower + 1, n - 2))
+        return text + i + bit;
+      mask &= mask - 1;
+    }
+  }
+#endif
+  for (; i + n <= len; i++) {
+    if (fold(text[i]) == (unsigned char)lower[0] && fold_equal(text + i, lower, n))
+      return text + i;
+  }
+  return NULL;
+}
+
+// Narrow text/len down to the given 1-based field. Returns false when the entry has fewer fields.
+static bool find_field(const char **text, size_t *len, int field, char separator) {
+  const char *start = *text;
+  const char *end = start + *len;
+
+  for (int i = 1; i < field; i++) {
+    const char *sep = memchr(start, separator, end - start);
+    if (sep == NULL)
+      return false;
+    start = sep + 1;
+  }
+
+  const char *sep = memchr(start, separator, end - start);
+  *text = start;
+  *len = (sep ? sep : end) - start;
+  return true;
+}
+
+MatchState *match_state_new(const Config *config) {
+  MatchState *state = NULL;
+  state = m_alloc(state, sizeof(MatchState), "match state");
+  if (state == NULL)
+    return NULL;
+  state->count = config->regex_count;
+  state->caches = NULL;
+  if (state->count > 0) {
+    state->caches = m_alloc(state->caches, state->count * sizeof(DfaCache *), "match state");
+    if (state->caches == NULL) {
+      free(state);
+      return NULL;
+    }
+    memset(state->caches, 0, state->count * sizeof(DfaCache *));
+    bool ok = true;
+    for (int k = 0; k < config->identifier_count; k++) {
+      for (int l = 0; l < config->identifiers[k]->length; l++) {
+        const Item *item = &config->identifiers[k]->items[l];
+        if (item->dfa) {
+          state->caches[item->regex_slot] = dfa_cache_new(item->dfa);
+          ok = ok && state->caches[item->regex_slot] != NULL;
+        }
+      }
+    }
+    if (!ok) {
+      match_state_free(state);
+      return NULL;
+    }
+  }
+  return state;
+}
+
+void match_state_free(MatchState *state) {
+  for (int i = 0; i < state->count; i++) {
+    if (state->caches[i] != NULL)
+      dfa_cache_free(state->caches[i]);
+  }
+  free(state->caches);
+  free(state);
+}
+
+static bool item_matches(const Item *item, const char *log_entry, size_t entry_len, char separator, MatchState *state) {
+  const char *text = log_entry;
+  size_t len = entry_len;
+
+  if (item->field > 0 && !find_field(&text, &len, item->field, separator))
+    return false;
+  if (item->key != NULL && !find_json_key(&text, &len, item->key, item->key_len))
+    return false;
+  if (item->dfa)
+    return dfa_search(state->caches[item->regex_slot], text, len);
+  if (item->text_len > len)
+    return false;
+
+  if (item->icase) {
+    switch (item->anchor) {
+    case ANCHOR_PREFIX:
+      return fold_equal(text, item->text, item->text_len);
+    case ANCHOR_SUFFIX:
+      return fold_equal(text + len - item->text_len, item->text, item->text_len);
+    case ANCHOR_EXACT:
+      return len == item->text_len && fold_equal(text, item->text, len);
+    case ANCHOR_NONE:
+    default:
+      return icase_search(text, len, item->text, item->text_len) != NULL;
+    }
+  }
+
+  switch (item->anchor) {
+  case ANCHOR_PREFIX:
+    return memcmp(text, item->text, item->text_len) == 0;
+  case ANCHOR_SUFFIX:
+    return memcmp(text + len - item->text_len, item->text, item->text_len) == 0;
+  case ANCHOR_EXACT:
+    return len == item->text_len && memcmp(text, item->text, len) == 0;
+  case ANCHOR_NONE:
+  default:
+    return memmem(text, len, item->text, item->text_len) != NULL;
+  }
+}
+
+// An identifier matches when all its required items are found and none of its
+// forbidden ones. Items are checked in order, stopping at the first one that decides.
+// This is a walk with one search per item rather than one shared scan of the entry
+// for all items: most entries are ruled out by the first item, whose memmem (SIMD in
+// glibc) stops there, while a shared automaton would read every byte of every entry.
+// The required and forbidden masks only say which bits the found items must produce.
+static bool identifier_matches(const Identifier *identifier, const char *log_entry, size_t entry_len,
+                               char separator, MatchState *state) {
+  uint64_t found = 0;
+  for (int l = 0; l < identifier->length; l++) {
+    uint64_t bit = UINT64_C(1) << l;
+    if (item_matches(&identifier->items[l], log_entry, entry_len, separator, state)) {
+      if (identifier->forbidden & bit)
+        return false;
+      found |= bit;
+    } else if (identifier->required & bit) {
+      return false;
+    }
+  }
+  return (found & identifier->required) == identifier->required;
+}
+
+// Index of the first identifier that matches the entry, or -1 when none does
+int matching_identifier(const char *log_entry, size_t entry_len, const Config *config, MatchState *state) {
+  for (int k = 0; k < config->identifier_count; k++) {
+    if (identifier_matches(config->identifiers[k], log_entry, entry_len, config->field_separator, state))
+      return k;
+  }
+  return -1;
+}
@@ -0,0 +1,21 @@
+#ifndef MATCH_H
+#define MATCH_H
+
+#include "config.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// Per-run matching state: the lazy DFA of every regex item in a config. Each thread
+// matching against a config needs its own.
+typedef struct {
+  DfaCache **caches;
+  int count;
+} MatchState;
+
+// NULL when memory runs out
+MatchState *match_state_new(const Config *config);
+void match_state_free(MatchState *state);
+
+int matching_identifier(const char *log_entry, size_t entry_len, const Config *config, MatchState *state);
+
+#endif
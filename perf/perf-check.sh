@@ -0,0 +1,142 @@
+#!/bin/sh
+# Throughput regression check for log-cleaner.
+#
+#   perf/perf-check.sh [--record]
+#
+# Generates one log per scenario, cleans a fresh copy of it PERF_RUNS times and
+# takes the fastest run. Each scenario's MB/s and lines/s is compared against
+# perf/perf-baseline.txt, and the script exits non-zero when any of them is more
+# than PERF_TOLERANCE percent slower. --record writes the results as the new
+# baseline instead. A scenario that comes out slow is measured once more before it
+# counts as a regression. Baselines depend on the host, record one on the machine the
+# check runs on.
+set -eu
+
+dir=$(cd "$(dirname "$0")" && pwd)
+bin="$dir/../log-cleaner"
+config="$dir/perf-config.json"
+baseline="$dir/perf-baseline.txt"
+runs=${PERF_RUNS:-7}
+tolerance=${PERF_TOLERANCE:-20}
+lines=${PERF_LINES:-1000000}
+
+# on tmpfs where there is one, so disk writeback does not add noise to the timings
+if [ -d /dev/shm ] && [ -w /dev/shm ]; then
+  work=$(mktemp -d /dev/shm/log-cleaner-perf.XXXXXX)
+else
+  work=$(mktemp -d)
+fi
+trap 'rm -rf "$work"' EXIT
+
+# generate <scenario>: a deterministic log with roughly a third noise
+generate() {
+  awk -v scenario="$1" -v lines="$lines" 'BEGIN {
+    srand(42)
+    for (i = 0; i < lines; i++) {
+      r = rand()
+      t = sprintf("%02d:%02d:%02d", i % 24, i % 60, (i * 7) % 60)
+      if (scenario == "plain" || scenario == "regex") {
+        if (r < 0.2)
+          printf "[ERROR][2026-01-30 %s] ...p/_transport.lua:36\t\"rpc\"\t\"clangd\"\t\"stderr\"\t\"E[%s.%03d] offsetEncoding capability is a deprecated clangd extension\"\n", t, t, i % 1000
+        else if (r < 0.35)
+          printf "[INFO][2026-01-30 %s] rpc\tstderr\theartbeat %d\n", t, i
+        else
+          printf "[INFO][2026-01-30 %s] lsp\trequest\tcompletion\trequest %d took %dms\n", t, i, int(r * 1000)
+      } else if (scenario == "records") {
+        printf "[ERROR][2026-01-30 %s] %s request %d failed\n", t, r < 0.3 ? "clangd" : "pyright", i
+        if (r < 0.5)
+          printf "stack traceback:\n\t[C]: in function error\n\tlsp/client.lua:%d: in function handler\n", i % 900
+      } else if (scenario == "json") {
+        if (r < 0.2)
+          printf "{\"ts\":\"2026-01-30T%s\",\"level\":\"debug\",\"logger\":\"rpc\",\"msg\":\"semantic tokens %d\"}\n", t, i
+        else if (r < 0.35)
+          printf "{\"ts\":\"2026-01-30T%s\",\"level\":\"info\",\"http\":{\"method\":\"GET\",\"path\":\"/healthz\",\"status\":200},\"msg\":\"request %d\"}\n", t, i
+        else
+          printf "{\"ts\":\"2026-01-30T%s\",\"level\":\"info\",\"http\":{\"method\":\"POST\",\"path\":\"/api/index\",\"status\":201},\"msg\":\"debug level set for request %d\"}\n", t, i
+      } else {
+        if (r < 0.25)
+          printf "[DEBUG][2026-01-30 %s]\trpc\t\"clangd\"\tsemantic tokens %d\n", t, i
+        else if (r < 0.35)
+          printf "[WARN][2026-01-30 %s]\trpc\t\"pyright\"\tWARNING: stub file not found %d\n", t, i
+        else
+          printf "[INFO][2026-01-30 %s]\trpc\t\"pyright\"\tindexed %d files\n", t, i
+      }
+    }
+  }' > "$work/$1.source"
+}
+
+# run <scenario>: prints "<scenario> <MB/s> <lines/s>" for the fastest run
+run() {
+  best=
+  for i in $(seq "$runs"); do
+    cp "$work/$1.source" "$work/$1.log"
+    start=$(date +%s%N)
+    "$bin" "$work/$1.log" "$config" > /dev/null
+    end=$(date +%s%N)
+    ns=$((end - start))
+    if [ -z "$best" ] || [ "$ns" -lt "$best" ]; then
+      best=$ns
+    fi
+  done
+  bytes=$(wc -c < "$work/$1.source")
+  count=$(wc -l < "$work/$1.source")
+  awk -v s="$1" -v b="$bytes" -v c="$count" -v ns="$best" \
+    'BEGIN { printf "%s %.1f %.0f\n", s, b / 1048576 / (ns / 1e9), c / (ns / 1e9) }'
+}
+
+# slower <result line>: succeeds when the result is beyond tolerance of its baseline
+slower() {
+  echo "$1" | awk -v tolerance="$tolerance" -v baseline="$baseline" '{
+    while ((getline line < baseline) > 0) {
+      split(line, b, " ")
+      if (b[1] == $1)
+        exit !($2 < b[2] * (1 - tolerance / 100) || $3 < b[3] * (1 - tolerance / 100))
+    }
+    exit 1
+  }'
+}
+
+if [ "${1:-}" = "--record" ]; then
+  results="$work/results.txt"
+  # the slower of two measurements, so the baseline is a speed the host reliably reaches
+  for scenario in plain records fields regex json; do
+    generate "$scenario"
+    { run "$scenario"; run "$scenario"; } | sort -k2 -n | head -n 1 >> "$results"
+  done
+  {
+    echo "# scenario MB/s lines/s, recorded $(date +%Y-%m-%d) on $(uname -n)"
+    cat "$results"
+  } > "$baseline"
+  cat "$baseline"
+  exit 0
+fi
+
+if [ ! -f "$baseline" ]; then
+  echo "No baseline at $baseline, record one with: make perf-baseline" >&2
+  exit 2
+fi
+
+failed=0
+for scenario in plain records fields regex json; do
+  generate "$scenario"
+  result=$(run "$scenario")
+  # a slow result is measured again before it counts, one noisy batch of runs is not a regression
+  if slower "$result"; then
+    result=$(run "$scenario")
+  fi
+  status=ok
+  if ! grep -q "^$scenario " "$baseline"; then
+    status="no baseline"
+  elif slower "$result"; then
+    status=REGRESSED
+    failed=1
+  fi
+  echo "$result" | awk -v status="$status" -v baseline="$baseline" '{
+    while ((getline line < baseline) > 0) {
+      split(line, b, " ")
+      if (b[1] == $1) { mb = b[2]; ls = b[3] }
+    }
+    printf "%-8s %8.1f MB/s (baseline %8.1f) %10.0f lines/s (baseline %10.0f)  %s\n", $1, $2, mb, $3, ls, status
+  }'
+done
+exit $failed
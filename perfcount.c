@@ -0,0 +1,134 @@
+#define _GNU_SOURCE
+#include "perfcount.h"
+#include "util.h"
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+static const uint64_t event_configs[PERF_EVENT_COUNT] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+static int open_event(uint64_t config, bool user_only) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = config;
+  attr.exclude_kernel = user_only;
+  attr.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+// Open the counters for the calling thread, or return NULL after saying why when
+// none can be used. Kernel time is counted too where perf_event_paranoid allows it.
+PerfCounters *perf_counters_open(void) {
+  PerfCounters *counters = NULL;
+  counters = m_alloc(counters, sizeof(PerfCounters), "performance counters");
+  if (counters == NULL)
+    return NULL;
+  counters->user_only = false;
+
+  int opened = 0;
+  int err = 0;
+  for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+    counters->fds[i] = open_event(event_configs[i], counters->user_only);
+    if (counters->fds[i] < 0 && (errno == EACCES || errno == EPERM) && !counters->user_only) {
+      counters->user_only = true;
+      counters->fds[i] = open_event(event_configs[i], counters->user_only);
+    }
+    if (counters->fds[i] < 0)
+      err = errno;
+    else
+      opened++;
+  }
+
+  if (opened == 0) {
+    if (err == ENOENT || err == EOPNOTSUPP)
+      printf("Performance counters are not supported by this CPU or virtual machine\n");
+    else
+      printf("Performance counters unavailable (%s), see /proc/sys/kernel/perf_event_paranoid\n", strerror(err));
+    free(counters);
+    return NULL;
+  }
+  return counters;
+}
+
+void perf_counters_close(PerfCounters *counters) {
+  for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+    if (counters->fds[i] >= 0)
+      close(counters->fds[i]);
+  }
+  free(counters);
+}
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void read_counters(const PerfCounters *counters, uint64_t *values) {
+  for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+    values[i] = 0;
+    if (counters != NULL && counters->fds[i] >= 0 && read(counters->fds[i], &values[i], sizeof(uint64_t)) != sizeof(uint64_t))
+      values[i] = 0;
+  }
+}
+
+void perf_phase_init(PerfPhase *phase, const PerfCounters *counters) {
+  memset(phase, 0, sizeof(PerfPhase));
+  phase->counters = counters;
+}
+
+void perf_phase_begin(PerfPhase *phase) {
+  phase->start_seconds = now_seconds();
+  read_counters(phase->counters, phase->start);
+}
+
+void perf_phase_end(PerfPhase *phase) {
+  uint64_t end[PERF_EVENT_COUNT];
+  read_counters(phase->counters, end);
+  phase->seconds += now_seconds() - phase->start_seconds;
+  for (int i = 0; i < PERF_EVENT_COUNT; i++)
+    phase->totals[i] += end[i] - phase->start[i];
+}
+
+// Take out a part that ran nested inside the phase, e.g. writes during a scan
+void perf_phase_subtract(PerfPhase *phase, const PerfPhase *part) {
+  phase->seconds -= part->seconds;
+  for (int i = 0; i < PERF_EVENT_COUNT; i++)
+    phase->totals[i] -= part->totals[i] < phase->totals[i] ? part->totals[i] : phase->totals[i];
+}
+
+static void print_count(const PerfPhase *phase, PerfEvent event) {
+  if (phase->counters->fds[event] < 0)
+    printf(" %14s", "n/a");
+  else
+    printf(" %14llu", (unsigned long long)phase->totals[event]);
+}
+
+// One row of the report, with the throughput over bytes when it is not 0
+void perf_phase_print(const char *name, const PerfPhase *phase, double bytes) {
+  printf("%-7s %9.3f", name, phase->seconds);
+  print_count(phase, PERF_CYCLES);
+  print_count(phase, PERF_INSTRUCTIONS);
+  print_count(phase, PERF_CACHE_MISSES);
+  print_count(phase, PERF_BRANCH_MISSES);
+  if (phase->counters->fds[PERF_CYCLES] >= 0 && phase->counters->fds[PERF_INSTRUCTIONS] >= 0 &&
+      phase->totals[PERF_CYCLES] > 0)
+    printf(" %5.2f", (double)phase->totals[PERF_INSTRUCTIONS] / phase->totals[PERF_CYCLES]);
+  else
+    printf(" %5s", "n/a");
+  if (bytes > 0 && phase->seconds > 0)
+    printf(" %9.1f MB/s", bytes / (1024 * 1024) / phase->seconds);
+  putchar('\n');
+}
@@ -0,0 +1,34 @@
+#ifndef PERFCOUNT_H
+#define PERFCOUNT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Hardware counters read around the phases of a run, through perf_event_open
+typedef enum { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_CACHE_MISSES, PERF_BRANCH_MISSES, PERF_EVENT_COUNT } PerfEvent;
+
+// Counters of the calling thread. An event the CPU or kernel does not offer has fd -1.
+typedef struct {
+  int fds[PERF_EVENT_COUNT];
+  bool user_only; // kernel time is excluded, as perf_event_paranoid does not allow it
+} PerfCounters;
+
+// Counts and wall time accumulated over every begin/end of a phase
+typedef struct {
+  const PerfCounters *counters;
+  uint64_t start[PERF_EVENT_COUNT];
+  uint64_t totals[PERF_EVENT_COUNT];
+  double start_seconds;
+  double seconds;
+} PerfPhase;
+
+PerfCounters *perf_counters_open(void);
+void perf_counters_close(PerfCounters *counters);
+
+void perf_phase_init(PerfPhase *phase, const PerfCounters *counters);
+void perf_phase_begin(PerfPhase *phase);
+void perf_phase_end(PerfPhase *phase);
+void perf_phase_subtract(PerfPhase *phase, const PerfPhase *part);
+void perf_phase_print(const char *name, const PerfPhase *phase, double bytes);
+
+#endif
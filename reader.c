@@ -0,0 +1,118 @@
+#define _GNU_SOURCE
+#include "reader.h"
+#include "alloc.h"
+#include "util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+Reader *reader_open(const char *path, char separator) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+
+  Reader *reader = NULL;
+  reader = m_alloc(reader, sizeof(Reader), "input reader");
+  if (reader == NULL) {
+    close(fd);
+    errno = ENOMEM;
+    return NULL;
+  }
+  reader->fd = fd;
+  reader->separator = separator;
+  reader->position = 0;
+  reader->size = READER_BUFFER_SIZE;
+  reader->read_size = READER_BUFFER_SIZE;
+  reader->path = NULL;
+  reader->path = m_alloc(reader->path, strlen(path) + 1, "input reader path");
+  reader->buffer = huge_alloc(reader->size, "input buffer");
+  if (reader->path == NULL || reader->buffer == NULL) {
+    reader_close(reader);
+    errno = ENOMEM;
+    return NULL;
+  }
+  strcpy(reader->path, path);
+  reader->start = 0;
+  reader->end = 0;
+  reader->eof = false;
+  reader->error = 0;
+  return reader;
+}
+
+// Read more input, first moving the unconsumed data to the front of the buffer,
+// and growing the buffer if that data already fills it.
+static void fill(Reader *reader) {
+  if (reader->start > 0) {
+    memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+    reader->end -= reader->start;
+    reader->start = 0;
+  }
+  if (reader->end == reader->size) {
+    char *grown = huge_alloc(reader->size * 2, "input buffer");
+    if (grown == NULL) {
+      reader->error = ENOMEM;
+      reader->eof = true;
+      return;
+    }
+    memcpy(grown, reader->buffer, reader->end);
+    huge_free(reader->buffer, reader->size);
+    reader->buffer = grown;
+    reader->size *= 2;
+  }
+
+  size_t want = reader->size - reader->end;
+  if (want > reader->read_size)
+    want = reader->read_size;
+  ssize_t got;
+  do {
+    got = pread(reader->fd, reader->buffer + reader->end, want, reader->position);
+  } while (got < 0 && errno == EINTR);
+  if (got < 0) {
+    reader->error = errno;
+    reader->eof = true;
+    return;
+  }
+  if (got == 0)
+    reader->eof = true;
+  reader->end += got;
+  reader->position += got;
+}
+
+// Next record, reading more input while the buffered data may end inside it
+bool reader_next_record(Reader *reader, const char *record_start, size_t record_start_len, Record *record) {
+  for (;;) {
+    if (split_record(reader->buffer + reader->start, reader->end - reader->start, reader->separator, record_start,
+                     record_start_len, reader->eof, record)) {
+      reader->start += record->len;
+      return true;
+    }
+    if (reader->eof)
+      return false;
+    fill(reader);
+    if (reader->error)
+      return false;
+  }
+}
+
+void reader_close(Reader *reader) {
+  close(reader->fd);
+  huge_free(reader->buffer, reader->size);
+  free(reader->path);
+  free(reader);
+}
+
+// File offset of the next record
+off_t reader_offset(const Reader *reader) {
+  return reader->position - (off_t)(reader->end - reader->start);
+}
+
+// Continue reading from offset, dropping anything buffered
+void reader_seek(Reader *reader, off_t offset) {
+  reader->position = offset;
+  reader->start = 0;
+  reader->end = 0;
+  reader->eof = false;
+}
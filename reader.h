@@ -0,0 +1,40 @@
+#ifndef READER_H
+#define READER_H
+
+#include "record.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// 4MB input buffer, grown when a single record does not fit. The fuzz build
+// makes it tiny, so records cross refills.
+#ifndef READER_BUFFER_SIZE
+#define READER_BUFFER_SIZE (4 * 1024 * 1024)
+#endif
+
+// Reads a file in large blocks and hands out records as spans of its buffer, so a
+// record is always contiguous in memory and never copied. Lines end at separator,
+// which for '\n' also covers "\r\n" endings.
+typedef struct {
+  int fd;
+  char separator;
+  off_t position; // file offset the next read starts at
+  char *path;
+  char *buffer;
+  size_t size;
+  size_t start;     // first byte not yet handed out
+  size_t end;       // end of the data read so far
+  size_t read_size; // most bytes one read asks for, the whole buffer unless set lower
+  bool eof;
+  int error; // errno of a failed read or buffer growth, which ends the records early
+} Reader;
+
+// NULL with errno set when the file cannot be opened or memory runs out
+Reader *reader_open(const char *path, char separator);
+// The record's data points into the reader's buffer and stays valid until the next call
+bool reader_next_record(Reader *reader, const char *record_start, size_t record_start_len, Record *record);
+void reader_close(Reader *reader);
+off_t reader_offset(const Reader *reader);
+void reader_seek(Reader *reader, off_t offset);
+
+#endif
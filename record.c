@@ -0,0 +1,66 @@
+#include "record.h"
+#include <string.h>
+
+bool split_record(const char *data, size_t len, char separator, const char *record_start, size_t record_start_len,
+                  bool final, Record *record) {
+  if (len == 0)
+    return false;
+  const char *line_end = memchr(data, separator, len);
+  if (line_end == NULL && !final)
+    return false;
+  size_t record_len = line_end ? (size_t)(line_end + 1 - data) : len;
+
+  // continuation lines, up to the next line that starts with record_start or is padding
+  bool alone = line_end != NULL && is_padding(data, line_end - data);
+  while (record_start != NULL && !alone) {
+    if (record_len == len) {
+      if (!final)
+        return false;
+      break;
+    }
+    const char *next = data + record_len;
+    size_t rest = len - record_len;
+    line_end = memchr(next, separator, rest);
+    if (rest < record_start_len && line_end == NULL && !final) // too little of the line to tell
+      return false;
+    if (rest >= record_start_len && memcmp(next, record_start, record_start_len) == 0)
+      break;
+    if (line_end == NULL) {
+      if (!final)
+        return false;
+      record_len = len;
+    } else if (is_padding(next, line_end - next)) {
+      break;
+    } else {
+      record_len += line_end + 1 - next;
+    }
+  }
+
+  record->data = data;
+  record->len = record_len;
+  record->content_len = record_len;
+  if (data[record_len - 1] == separator) {
+    record->content_len--;
+    if (separator == '\n' && record->content_len > 0 && data[record_len - 2] == '\r')
+      record->content_len--;
+  }
+  return true;
+}
+
+bool is_padding(const char *data, size_t len) {
+  if (len > 0 && data[0] == '\0') { // too short for the note
+    for (size_t i = 1; i < len; i++) {
+      if (data[i] != '\0')
+        return false;
+    }
+    return true;
+  }
+  size_t note_len = strlen(PADDING_NOTE);
+  if (len < note_len || memcmp(data, PADDING_NOTE, note_len) != 0)
+    return false;
+  for (size_t i = note_len; i < len; i++) {
+    if (data[i] != ' ')
+      return false;
+  }
+  return true;
+}
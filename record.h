@@ -0,0 +1,31 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// One record of the input: a line, or with a record_start marker, a line plus the
+// lines after it that do not start a record. data points into the caller's buffer.
+typedef struct {
+  const char *data;
+  size_t len;         // including the final line ending, if there is one
+  size_t content_len; // without the final line ending ("\n", "\r\n" or the custom separator)
+} Record;
+
+// The line in place cleaning overwrites removed entries with, padded with spaces. A
+// space too short for it gets a line of NUL bytes instead.
+#define PADDING_NOTE "[log-cleaner: entries removed]"
+
+// Split the record at the start of data[0, len). final says nothing follows len, so a
+// last line without a line ending is whole. False when there is no record, or when it
+// may go on past len and more data is needed to tell. A padding line is a record of
+// its own, never a continuation line. Shared by the file reader and the library, so
+// both see the same records.
+bool split_record(const char *data, size_t len, char separator, const char *record_start, size_t record_start_len,
+                  bool final, Record *record);
+
+// Whether the content of a line, without its line ending, is a padding line, the note
+// or NUL bytes
+bool is_padding(const char *data, size_t len);
+
+#endif
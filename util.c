@@ -0,0 +1,60 @@
+#define _GNU_SOURCE
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Returns NULL, after saying what could not be allocated, when memory runs out.
+// Callers pass the failure up so only the job that needed the memory fails. The
+// library stays silent, the output of the program it is in is not its to write to.
+void *m_alloc(void *ptr, size_t size, const char *field_name) {
+  ptr = malloc(size);
+
+#ifndef LOG_CLEANER_LIBRARY
+  if (ptr == NULL)
+    printf("Unable to allocate memory for %s\n", field_name);
+#else
+  (void)field_name;
+#endif
+
+  return ptr;
+}
+
+const char *get_filename(const char *path) {
+  const char *last_slash = strrchr(path, '/');
+  return last_slash ? last_slash + 1 : path;
+}
+
+char *create_timestamped_file_path(const char *file_path, const char *prefix) {
+  char base[256] = {0};
+  char timestamp[20];
+  char *ext;
+  time_t now = time(NULL);
+  struct tm t;
+  localtime_r(&now, &t);
+
+  const char *fname = get_filename(file_path);
+
+  ext = strrchr(fname, '.');
+  if (ext && strcmp(ext, ".log") == 0) {
+    size_t len = ext - fname;
+    strncpy(base, fname, len);
+    base[len] = '\0';
+  } else {
+    strcpy(base, fname);
+  }
+
+  strftime(timestamp, sizeof(timestamp), "%Y%m%d_%H%M%S", &t);
+
+  size_t dir_len = fname - file_path;
+  size_t new_len = dir_len + strlen(prefix) + 1 + strlen(base) + 1 + strlen(timestamp) + 5; // +5 for "_", ".log", \0
+  char *new_file_path = NULL;
+  new_file_path = m_alloc(new_file_path, new_len, "new file path");
+  if (new_file_path == NULL)
+    return NULL;
+
+  snprintf(new_file_path, new_len, "%.*s%s_%s_%s.log", (int)dir_len, file_path, prefix, base, timestamp);
+
+  return new_file_path; // Caller must free(), NULL when out of memory
+}
@@ -0,0 +1,10 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stddef.h>
+
+char *create_timestamped_file_path(const char *filename, const char *prefix);
+const char *get_filename(const char *path);
+void *m_alloc(void *ptr, size_t size, const char *err_msg);
+
+#endif
@@ -0,0 +1,238 @@
+#define _GNU_SOURCE
+#include "writer.h"
+#include "alloc.h"
+#include "util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static Writer *new_writer(int fd, const char *path) {
+  Writer *writer = NULL;
+  writer = m_alloc(writer, sizeof(Writer), "output writer");
+  if (writer == NULL) {
+    close(fd);
+    errno = ENOMEM;
+    return NULL;
+  }
+  writer->fd = fd;
+  writer->path = NULL;
+  writer->path = m_alloc(writer->path, strlen(path) + 1, "output writer path");
+  // page aligned, so the kernel can copy whole pages
+  writer->buffer = huge_alloc(WRITER_BUFFER_SIZE, "output buffer");
+  writer->used = 0;
+  writer->error = 0;
+  writer->temporary = false;
+  writer->temp_path = NULL;
+  writer->phase = NULL;
+  writer->before_write = NULL;
+  writer->before_write_context = NULL;
+  if (writer->path == NULL || writer->buffer == NULL) {
+    writer_close(writer);
+    errno = ENOMEM;
+    return NULL;
+  }
+  strcpy(writer->path, path);
+  return writer;
+}
+
+Writer *writer_open_in_place(const char *path) {
+  int fd = open(path, O_RDWR | O_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+  return new_writer(fd, path);
+}
+
+// Hidden name next to path, "<dir>/.<name>.<pid>.tmp", for a file until it is committed
+static char *hidden_path(const char *path) {
+  const char *name = get_filename(path);
+  size_t len = strlen(path) + 32;
+  char *hidden = NULL;
+  hidden = m_alloc(hidden, len, "temporary file path");
+  if (hidden != NULL)
+    snprintf(hidden, len, "%.*s.%s.%d.tmp", (int)(name - path), path, name, (int)getpid());
+  return hidden;
+}
+
+Writer *writer_open_temp(const char *path) {
+  const char *name = get_filename(path);
+  char dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "%.*s", name > path ? (int)(name - path) : 1, name > path ? path : ".");
+
+  char *temp_path = NULL;
+  int fd = open(dir, O_TMPFILE | O_WRONLY | O_CLOEXEC, 0666);
+  if (fd < 0 && (errno == EOPNOTSUPP || errno == EISDIR || errno == EINVAL)) {
+    // file systems without O_TMPFILE get a hidden file instead
+    temp_path = hidden_path(path);
+    if (temp_path == NULL) {
+      errno = ENOMEM;
+      return NULL;
+    }
+    fd = open(temp_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+  }
+  if (fd < 0) {
+    int error = errno;
+    free(temp_path);
+    errno = error;
+    return NULL;
+  }
+
+  Writer *writer = new_writer(fd, path);
+  if (writer == NULL) {
+    if (temp_path != NULL)
+      unlink(temp_path);
+    free(temp_path);
+    errno = ENOMEM;
+    return NULL;
+  }
+  writer->temporary = true;
+  writer->temp_path = temp_path;
+  return writer;
+}
+
+// Write all of iov, picking up after short writes. After a failed write the
+// writer only keeps the error, for writer_close to report.
+static void write_all(Writer *writer, struct iovec *iov, int count) {
+  if (writer->error == 0 && writer->before_write)
+    writer->error = writer->before_write(writer->before_write_context);
+  if (writer->error)
+    return;
+  if (writer->phase)
+    perf_phase_begin(writer->phase);
+  while (count > 0) {
+    ssize_t written = writev(writer->fd, iov, count);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      writer->error = errno;
+      break;
+    }
+    while (count > 0 && (size_t)written >= iov->iov_len) {
+      written -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0) {
+      iov->iov_base = (char *)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+  if (writer->phase)
+    perf_phase_end(writer->phase);
+}
+
+void writer_write(Writer *writer, const char *data, size_t len) {
+  if (len >= WRITER_BUFFER_SIZE / 2) {
+    struct iovec iov[2] = {
+        {writer->buffer,   writer->used},
+        {(void *)data,     len         }
+    };
+    write_all(writer, iov, 2);
+    writer->used = 0;
+    return;
+  }
+
+  if (writer->used + len > WRITER_BUFFER_SIZE)
+    writer_flush(writer);
+  memcpy(writer->buffer + writer->used, data, len);
+  writer->used += len;
+}
+
+void writer_seek(Writer *writer, off_t offset) {
+  writer_flush(writer);
+  if (writer->error == 0 && lseek(writer->fd, offset, SEEK_SET) < 0)
+    writer->error = errno;
+}
+
+void writer_flush(Writer *writer) {
+  if (writer->used == 0)
+    return;
+  struct iovec iov = {writer->buffer, writer->used};
+  write_all(writer, &iov, 1);
+  writer->used = 0;
+}
+
+// Give the output the owner and mode of the file it replaces, so a cleaned log keeps
+// them, as the temporary file is created by whoever runs the clean with the umask
+static int keep_attributes(Writer *writer) {
+  struct stat original;
+  if (stat(writer->path, &original) != 0)
+    return errno == ENOENT ? 0 : errno;
+  struct stat st;
+  if (fstat(writer->fd, &st) != 0)
+    return errno;
+  if ((st.st_uid != original.st_uid || st.st_gid != original.st_gid) &&
+      fchown(writer->fd, original.st_uid, original.st_gid) != 0)
+    return errno;
+  // after the chown, which clears set-id bits
+  if (fchmod(writer->fd, original.st_mode & 07777) != 0)
+    return errno;
+  return 0;
+}
+
+int writer_commit(Writer *writer, bool sync) {
+  writer_flush(writer);
+  if (writer->error == 0)
+    writer->error = keep_attributes(writer);
+  if (writer->error == 0 && sync && fdatasync(writer->fd) != 0)
+    writer->error = errno;
+  if (writer->error)
+    return writer->error;
+
+  // an O_TMPFILE gets a hidden name first, as linkat cannot replace a file
+  if (writer->temp_path == NULL) {
+    char *temp_path = hidden_path(writer->path);
+    if (temp_path == NULL)
+      return writer->error = ENOMEM;
+    char proc_path[64];
+    snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", writer->fd);
+    if (linkat(AT_FDCWD, proc_path, AT_FDCWD, temp_path, AT_SYMLINK_FOLLOW) != 0 &&
+        linkat(writer->fd, "", AT_FDCWD, temp_path, AT_EMPTY_PATH) != 0) {
+      writer->error = errno;
+      free(temp_path);
+      return writer->error;
+    }
+    writer->temp_path = temp_path;
+  }
+
+  if (rename(writer->temp_path, writer->path) != 0)
+    return writer->error = errno;
+  free(writer->temp_path);
+  writer->temp_path = NULL;
+  writer->temporary = false;
+  return 0;
+}
+
+int sync_directory(const char *path) {
+  const char *name = get_filename(path);
+  char dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "%.*s", name > path ? (int)(name - path) : 1, name > path ? path : ".");
+  int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+    return errno;
+  int error = fsync(fd) != 0 ? errno : 0;
+  close(fd);
+  return error;
+}
+
+// Flush and close the file. Returns 0, or the errno of the first write that failed.
+// A temporary file that was not committed is dropped.
+int writer_close(Writer *writer) {
+  if (writer->buffer && !writer->temporary)
+    writer_flush(writer);
+  if (close(writer->fd) != 0 && writer->error == 0)
+    writer->error = errno;
+  if (writer->temp_path != NULL)
+    unlink(writer->temp_path);
+  int error = writer->error;
+  free(writer->temp_path);
+  huge_free(writer->buffer, WRITER_BUFFER_SIZE);
+  free(writer->path);
+  free(writer);
+  return error;
+}
@@ -0,0 +1,53 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include "perfcount.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// 4MB output buffer per file, written out with writev once full. The fuzz build
+// makes it tiny, so every flush path is taken.
+#ifndef WRITER_BUFFER_SIZE
+#define WRITER_BUFFER_SIZE (4 * 1024 * 1024)
+#endif
+
+// Buffered output file that takes slices of known length. Slices of half the buffer
+// or more skip the copy and go out in the same writev as the pending buffer.
+typedef struct {
+  int fd;
+  char *path;
+  char *buffer;
+  size_t used;
+  int error;        // errno of the first failed write, later writes are dropped
+  bool temporary;   // from writer_open_temp and not yet committed
+  char *temp_path;  // hidden name the temporary file has, NULL while it has none
+  PerfPhase *phase; // the writes are counted in this phase when set
+  // When set, called before each write to the file, with before_write_context. A
+  // nonzero errno it returns fails the write, as a failed write would.
+  int (*before_write)(void *context);
+  void *before_write_context;
+} Writer;
+
+// Output that only appears at path once committed: an unnamed O_TMPFILE in the
+// directory of path, or a hidden file where the file system has no O_TMPFILE.
+// Closing it without a commit leaves nothing behind. NULL with errno set when the
+// file cannot be created or memory runs out.
+Writer *writer_open_temp(const char *path);
+// An existing file, opened for reading and writing without truncating it, with writes
+// starting at offset 0. Records are moved down within the file they are read from.
+Writer *writer_open_in_place(const char *path);
+void writer_write(Writer *writer, const char *data, size_t len);
+void writer_flush(Writer *writer);
+// Flush, then continue writing at offset
+void writer_seek(Writer *writer, off_t offset);
+// Flush a temporary output, fdatasync it when sync is set, and rename it to its
+// path, replacing any file there with the same owner and mode. Returns 0 or an errno,
+// the file is not committed then.
+int writer_commit(Writer *writer, bool sync);
+int writer_close(Writer *writer);
+
+// fsync the directory holding path, so renames into it survive a crash. 0 or an errno.
+int sync_directory(const char *path);
+
+#endif